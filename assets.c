@@ -0,0 +1,16 @@
+/*
+ * assets.c - files built into the binary (see assets.h)
+ */
+#include <string.h>
+
+#include "assets.h"
+
+//the embedded file called name, NULL if it wasn't built in
+const Asset *assetFind(const char *name)
+{
+    for (int i = 0; i < numAssets; i++) {
+        if (strcmp(assets[i].name, name) == 0)
+            return &assets[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,26 @@
+/*
+ * assets.h - the files from resources/ the client needs, built into the binary
+ *
+ * assets_data.c is generated from resources/ by mkassets when the client is
+ * built (see the Makefile), so the client starts without opening any files
+ * and from any working directory.
+ */
+#ifndef __ASSETS_H__
+#define __ASSETS_H__
+
+#include <stddef.h>
+
+typedef struct
+{
+    const char *name;           // file name without the directory
+    const unsigned char *data;
+    size_t size;
+} Asset;
+
+// defined in the generated assets_data.c
+extern const Asset assets[];
+extern const int numAssets;
+
+const Asset *assetFind(const char *name);
+
+#endif /* __ASSETS_H__ */
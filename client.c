@@ -2,13 +2,28 @@
 #include <stdbool.h>
 #include <time.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <limits.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
 #include "csapp.h"
-
-// Dimensions for the drawn grid (should be GRIDSIZE * texture dimensions)
+#include "trace.h"
+#include "terrain.h"
+#include "spsc.h"
+#include "tbuf.h"
+#include "glyphs.h"
+#include "sprites.h"
+#include "density.h"
+#include "pacer.h"
+#include "assets.h"
+
+// Dimensions of the view onto the grid, below the header; the camera decides
+// which part of the board it shows
 #define GRID_DRAW_WIDTH 640
 #define GRID_DRAW_HEIGHT 640
 
@@ -18,8 +33,98 @@
 // Header displays current score
 #define HEADER_HEIGHT 50
 
-// Number of cells vertically/horizontally in the grid
-#define GRIDSIZE 10
+// Size of the tile images, and of a square on screen before zooming; zoom
+// halves or doubles that between MIN_TILE_PX and MAX_TILE_PX
+#define TILE_SIZE 64
+#define MIN_TILE_PX 1
+#define MAX_TILE_PX 128
+
+// Below LOD_TILE_PX squares are too small for sprites: each 8x8 tile is drawn as one
+// block shaded by its tomato count, and players as markers of at least MARKER_PX
+#define LOD_TILE_PX 8
+#define MARKER_PX 8
+// Tiles the zoomed out layer can show across the view (one texel each)
+#define LOD_TEXELS (GRID_DRAW_WIDTH / LOD_TILE_PX + 2)
+
+// The minimap in the bottom right corner shows the whole board, its terrain redrawn
+// at most every MINIMAP_REFRESH_MS; a texel is a cell, a tile or a 64x64 block,
+// the finest that fits
+#define MINIMAP_SIZE 128
+#define MINIMAP_MARGIN 8
+#define MINIMAP_REFRESH_MS 250
+#if GRIDSIZE <= MINIMAP_SIZE
+#define MINIMAP_UNIT 1
+#elif TERRAIN_TILES_PER_ROW <= MINIMAP_SIZE
+#define MINIMAP_UNIT 8
+#else
+#define MINIMAP_UNIT (8 * DENSITY_BLOCK_TILES)
+#endif
+#define MINIMAP_TEXELS ((GRIDSIZE + MINIMAP_UNIT - 1) / MINIMAP_UNIT)
+
+// Frames a second unless FPS=<n> says otherwise; vsync is used when the driver offers
+// it, VSYNC=0 turns it off
+#define DEFAULT_FPS 60
+// With nothing new to draw the loop waits for an event instead, but at most this long
+// (longer while the window is hidden)
+#define IDLE_WAIT_MS 100
+#define HIDDEN_WAIT_MS 250
+// FRAME_STATS=1 prints frame-time statistics this often
+#define FRAME_STATS_MS 5000
+
+// F3 shows the performance overlay; its figures, and the rows PERF_CSV=<path> writes,
+// are worked out this often
+#define PERF_SAMPLE_MS 1000
+#define PERF_FONT_SIZE 18
+#define PERF_LINES 5
+// frame times in the overlay's graph, PERF_GRAPH_BAR pixels wide each
+#define PERF_GRAPH_FRAMES 120
+#define PERF_GRAPH_BAR 2
+#define PERF_GRAPH_HEIGHT 48
+
+// --headless draws this many frames unless told otherwise
+#define HEADLESS_FRAMES 1000
+// Synthetic updates for --headless: tomatoes added each tick, and a new level this often
+#define SYNTH_NEW_TOMATOES 4
+#define SYNTH_LEVEL_TICKS 200
+
+// The terrain layer holds the visible squares plus a partly visible one on each side
+#define LAYER_WIDTH (GRID_DRAW_WIDTH + 2 * MAX_TILE_PX)
+#define LAYER_HEIGHT (GRID_DRAW_HEIGHT + 2 * MAX_TILE_PX)
+
+// After a drop, try to resume the session this many times, this far apart
+// (the server keeps the player's slot for 30 seconds)
+#define RECONNECT_ATTEMPTS 20
+#define RECONNECT_DELAY_MS 1000
+
+// The server pushes state. Each side sends "k" after KEEPALIVE_MS without
+// sending anything else and gives up after KEEPALIVE_TIMEOUT_MS without
+// hearing anything (same values as the server)
+#define KEEPALIVE_MS 2000
+#define KEEPALIVE_TIMEOUT_MS (3 * KEEPALIVE_MS)
+// The server is pinged this often ("p,<ms>", it answers "q,<ms>" at once) to time round trips
+#define PING_MS 1000
+// Longest line taken from the server, a full state (3 bytes a cell at most); lines
+// longer than rio's buffer are joined in a separate one
+#define LINE_MAX_BYTES (TERRAIN_CELLS * 3 + 256)
+
+// Moves the render thread can queue ahead of the network thread, and moves
+// sent but not yet acknowledged by the server (replayed on every update)
+#define INPUT_QUEUE_SIZE 64
+#define MAX_PENDING_MOVES 64
+
+// When the server disagrees with the prediction the local player glides to
+// the right square over about CORRECTION_MS; corrections of more than
+// SNAP_DISTANCE squares (resume, respawn) jump
+#define CORRECTION_MS 80
+#define SNAP_DISTANCE 3
+
+// Other players are drawn INTERP_DELAY_MS in the past (environment, default
+// two server ticks), between the two updates around that time. When updates
+// are late they are extrapolated for at most EXTRAPOLATE_MS and never more
+// than EXTRAPOLATE_SQUARES past the last known square.
+#define SNAPSHOT_HISTORY 32
+#define EXTRAPOLATE_MS 100
+#define EXTRAPOLATE_SQUARES 0.25f
 
 typedef struct
 {
@@ -33,27 +138,193 @@ typedef enum
     TILE_TOMATO
 } TILETYPE;
 
-TILETYPE grid[GRIDSIZE][GRIDSIZE];
-
-Position player1;
-Position player2;
-Position player3;
-Position player4;
-Position* currentPlayer;
-
-int score;
-int level;
-int numTomatoes;
-int localPlayerId;
-char buf[MAXLINE] = "";
-bool shouldExit = false;
-bool p1Exist = false;
-bool p2Exist = false;
-bool p3Exist = false;
-bool p4Exist = false;
+typedef enum
+{
+    MOVE_UP,
+    MOVE_DOWN,
+    MOVE_LEFT,
+    MOVE_RIGHT
+} MOVE;
+
+static const int moveDx[] = {0, 0, -1, 1};
+static const int moveDy[] = {-1, 1, 0, 0};
+
+typedef struct
+{
+    unsigned seq;
+    MOVE move;
+    uint32_t keyMs; // SDL timestamp of the key press
+} PendingMove;
+
+// where a player is drawn, in squares
+typedef struct
+{
+    float x;
+    float y;
+    bool visible;
+} DrawPos;
+
+// player positions as of a server time
+typedef struct
+{
+    int serverMs;
+    Position players[4];
+    bool exists[4];
+} Snapshot;
+
+// what part of the board is on screen
+typedef struct
+{
+    int tilePx;         // size of a square on screen
+    int left;           // board pixel (at tilePx) shown at the view's left edge
+    int top;            // and at its top edge
+    int x0, y0, x1, y1; // squares at least partly visible: x0 <= x < x1, y0 <= y < y1
+} Camera;
+
+//everything the server tells us, as one value so it can be handed between threads
+typedef struct
+{
+    Terrain terrain; // tomato layer, in the server's tiled layout
+    DensityLog terrainLog; // which of its words changed, so the zoomed-out counts follow cheaply
+    Position players[4];
+    bool exists[4];
+    int score;
+    int level;
+    int numTomatoes;
+    int localPlayerId;
+    unsigned version; // version of the last state applied, 0 before the first one
+    unsigned inputAck; // our last move the server has processed
+    unsigned corrections; // bumped whenever the server's answer moved the predicted player
+    unsigned confirmedSeq;   // newest of our moves the server acked
+    uint32_t confirmedKeyMs; // and when its key was pressed
+    int serverMs;       // server time of the last update
+    bool clockSynced;   // clockOffset is valid, false until the first update
+    int clockOffset;    // our SDL_GetTicks() minus server time, smallest seen (least delayed update)
+    Snapshot history[SNAPSHOT_HISTORY]; // ring, the newest at historyNext - 1
+    int historyNext;
+    int historyCount;
+} GameState;
+
+//the network thread owns the socket and state, the render thread only sees published copies
+GameState state;
+GameState snapshots[3];
+tbuf_t published;     // network thread -> render thread, newest state wins
+spsc_t inputs;        // render thread -> network thread, queued MOVEs
+spsc_t inputTimes;    // and the time of each one's key press, pushed just before it
+int wakeFds[2];       // written after each push so the network thread stops waiting
+
+//network thread: moves not yet acknowledged, oldest first, and the prediction last shown
+PendingMove pending[MAX_PENDING_MOVES];
+int numPending;
+unsigned lastSeq;
+Position shown;
+unsigned corrections;
+
+//render thread: the local player's drawn position, eased after corrections
+DrawPos localDraw;
+bool localDrawPlaced;
+bool localEasing;
+unsigned seenCorrections;
+
+uint64_t sessionToken; // from the server's "t" line, used to resume after a drop
+int tickMs = 50;       // the server's push interval, also from the "t" line
+int interpDelayMs;
+char *host, *port;
+int clientfd;
+rio_t rio;
+rio_wt wio;
+atomic_bool shouldExit;
+
+//render thread: frame pacing, and whether the next frame must be drawn even if no state arrived
+Pacer pacer;
+bool redraw = true;
+bool windowHidden;
+Uint32 stateEvent; // pushed by the network thread to wake an idle render loop
+
+//network thread: RECORD_FILE=<path> saves every update with the time it arrived, for --headless
+FILE *recordFile;
+
+//kept by the network thread, read by the performance overlay
+typedef struct
+{
+    atomic_uint_fast64_t bytesIn;
+    atomic_uint_fast64_t bytesOut;
+    atomic_uint_fast64_t updates;  // states and deltas applied
+    atomic_uint_fast64_t parseNs;  // spent applying them
+    atomic_int rttMs;              // last ping's round trip, -1 until one comes back
+} NetStats;
+
+NetStats netStats = {.rttMs = -1};
+
+//render thread: the performance overlay (F3) and PERF_CSV log
+typedef struct
+{
+    bool shown;
+    FILE *csv;
+    uint32_t sampledAt;
+    // counters as they were at sampledAt
+    uint64_t frames;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t updates;
+    uint64_t parseNs;
+    // key to photon: time from a key press to the first frame showing the server's answer to it
+    unsigned measuredSeq;
+    int keyToPhotonMs;   // the latest
+    int keyToPhotonSum;  // since sampledAt
+    int keyToPhotonMax;
+    int keyToPhotonCount;
+    TextLayout lines[PERF_LINES];
+} PerfHud;
+
+PerfHud perf;
+TTF_Font *perfFont;
+GlyphAtlas perfGlyphs;
 
 TTF_Font* font;
 
+//render thread: every tile and player image in one texture, and the batch frames are drawn with
+SpriteAtlas sprites;
+SpriteBatch batch;
+SpriteDecode spriteDecode; // the images being decoded while we connect
+
+//render thread: the camera follows the local player at the chosen zoom
+Camera camera;
+int zoomTilePx = TILE_SIZE;
+
+//render thread: the visible terrain drawn once into a texture, patched where it changes
+//(NULL when the renderer has no render targets, then every visible square is drawn each frame)
+SDL_Texture *terrainLayer;
+Terrain layerTerrain; // what terrainLayer shows, for the squares in layerView
+Camera layerView;     // the squares and zoom the layer was drawn for
+bool layerValid;      // false until the first draw and after the renderer lost its targets
+
+//render thread: tomato counts per tile and block, and the zoomed out layer drawn from them
+Density density;
+SDL_Texture *lodLayer;
+uint32_t lodPixels[LOD_TEXELS * LOD_TEXELS];
+SDL_Rect lodTiles; // the tiles lodLayer shows
+bool lodValid;
+
+//render thread: the minimap, shown by default when the board doesn't fit the view
+SDL_Texture *minimap;
+uint32_t minimapPixels[MINIMAP_TEXELS * MINIMAP_TEXELS];
+bool showMinimap = GRIDSIZE * TILE_SIZE > GRID_DRAW_WIDTH;
+bool minimapStale = true;
+uint32_t minimapDrawnAt;
+
+// zoomed out colours, grass shading to tomato as a block fills up
+const SDL_Color grassColour = {40, 140, 40, 255};
+const SDL_Color tomatoColour = {215, 45, 35, 255};
+
+//render thread: HUD glyphs and the laid out score and level
+GlyphAtlas hudGlyphs;
+TextLayout scoreText;
+TextLayout levelText;
+bool hudLaidOut;
+int hudScore;
+int hudLevel;
+
 void initSDL()
 {
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -61,33 +332,92 @@ void initSDL()
         exit(EXIT_FAILURE);
     }
 
-    int rv = IMG_Init(IMG_INIT_PNG);
-    if ((rv & IMG_INIT_PNG) != IMG_INIT_PNG) {
-        fprintf(stderr, "Error initializing IMG: %s\n", IMG_GetError());
-        exit(EXIT_FAILURE);
-    }
-
     if (TTF_Init() == -1) {
         fprintf(stderr, "Error initializing TTF: %s\n", TTF_GetError());
         exit(EXIT_FAILURE);
     }
 }
 
-void moveTo(int x, int y)
+//the local player's position in s, NULL until the server has given us an id
+Position *localPlayer(GameState *s)
+{
+    if (s->localPlayerId < 1 || s->localPlayerId > 4)
+        return NULL;
+    return &s->players[s->localPlayerId - 1];
+}
+
+//append snap to the history, dropping the oldest when it is full
+void pushSnapshot(GameState *s, const Snapshot *snap)
+{
+    s->history[s->historyNext] = *snap;
+    s->historyNext = (s->historyNext + 1) % SNAPSHOT_HISTORY;
+    if (s->historyCount < SNAPSHOT_HISTORY)
+        s->historyCount++;
+}
+
+//the i-th oldest snapshot in the history
+const Snapshot *snapshotAt(const GameState *s, int i)
+{
+    return &s->history[(s->historyNext - s->historyCount + i + SNAPSHOT_HISTORY) % SNAPSHOT_HISTORY];
+}
+
+//network thread: step the local player one square ahead of the server, false if it can't go there
+bool moveTo(GameState *s, int x, int y)
 {
+    Position *currentPlayer = localPlayer(s);
+
+    if (currentPlayer == NULL)
+        return false;
+
     // Prevent falling off the grid
     if (x < 0 || x >= GRIDSIZE || y < 0 || y >= GRIDSIZE)
-        return;
+        return false;
+
+    // Players can't share a square, the server rejects the move
+    for (int i = 0; i < 4; i++) {
+        if (&s->players[i] != currentPlayer && s->exists[i] && s->players[i].x == x && s->players[i].y == y)
+            return false;
+    }
 
     // Sanity check: player can only move to 4 adjacent squares
     if (!(abs(currentPlayer->x - x) == 1 && abs(currentPlayer->y - y) == 0) &&
         !(abs(currentPlayer->x - x) == 0 && abs(currentPlayer->y - y) == 1)) {
         fprintf(stderr, "Invalid move attempted from (%d, %d) to (%d, %d)\n", currentPlayer->x, currentPlayer->y, x, y);
-        return;
+        return false;
     }
 
     currentPlayer->x = x;
     currentPlayer->y = y;
+    return true;
+}
+
+//render thread: hand a move to the network thread and wake it up
+void queueMove(MOVE move, uint32_t keyMs)
+{
+    char wake = 1;
+
+    // a full queue means the network is far behind, drop the key press; the queues fill
+    // together, so with room for the time there is room for the move
+    if (spsc_push(&inputTimes, keyMs)) {
+        spsc_push(&inputs, move);
+        write(wakeFds[1], &wake, 1);
+    }
+}
+
+//Ctrl-C or kill with tracing on (trace.h takes the signals then): quit the way Q does, so the
+//main loop cleans up and the trace is written at exit
+void requestQuit(void)
+{
+    shouldExit = true;
+}
+
+//double (steps > 0) or halve the size of a square on screen
+void zoom(int steps)
+{
+    if (steps > 0 && zoomTilePx < MAX_TILE_PX)
+        zoomTilePx *= 2;
+    if (steps < 0 && zoomTilePx > (lodLayer != NULL ? MIN_TILE_PX : LOD_TILE_PX))
+        zoomTilePx /= 2;
 }
 
 void handleKeyDown(SDL_KeyboardEvent* event)
@@ -96,20 +426,34 @@ void handleKeyDown(SDL_KeyboardEvent* event)
     if (event->repeat)
         return;
 
+    redraw = true;
+
     if (event->keysym.scancode == SDL_SCANCODE_Q || event->keysym.scancode == SDL_SCANCODE_ESCAPE)
         shouldExit = true;
 
     if (event->keysym.scancode == SDL_SCANCODE_UP || event->keysym.scancode == SDL_SCANCODE_W)
-        moveTo(currentPlayer->x, currentPlayer->y - 1);
+        queueMove(MOVE_UP, event->timestamp);
 
     if (event->keysym.scancode == SDL_SCANCODE_DOWN || event->keysym.scancode == SDL_SCANCODE_S)
-        moveTo(currentPlayer->x, currentPlayer->y + 1);
+        queueMove(MOVE_DOWN, event->timestamp);
 
     if (event->keysym.scancode == SDL_SCANCODE_LEFT || event->keysym.scancode == SDL_SCANCODE_A)
-        moveTo(currentPlayer->x - 1, currentPlayer->y);
+        queueMove(MOVE_LEFT, event->timestamp);
 
     if (event->keysym.scancode == SDL_SCANCODE_RIGHT || event->keysym.scancode == SDL_SCANCODE_D)
-        moveTo(currentPlayer->x + 1, currentPlayer->y);
+        queueMove(MOVE_RIGHT, event->timestamp);
+
+    if (event->keysym.scancode == SDL_SCANCODE_EQUALS || event->keysym.scancode == SDL_SCANCODE_KP_PLUS)
+        zoom(1);
+
+    if (event->keysym.scancode == SDL_SCANCODE_MINUS || event->keysym.scancode == SDL_SCANCODE_KP_MINUS)
+        zoom(-1);
+
+    if (event->keysym.scancode == SDL_SCANCODE_M)
+        showMinimap = !showMinimap;
+
+    if (event->keysym.scancode == SDL_SCANCODE_F3)
+        perf.shown = !perf.shown;
 }
 
 void processInputs()
@@ -126,115 +470,1343 @@ void processInputs()
                 handleKeyDown(&event.key);
 				break;
 
+            case SDL_MOUSEWHEEL:
+                zoom(event.wheel.y);
+                redraw = true;
+                break;
+
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_HIDDEN || event.window.event == SDL_WINDOWEVENT_MINIMIZED)
+                    windowHidden = true;
+                if (event.window.event == SDL_WINDOWEVENT_SHOWN || event.window.event == SDL_WINDOWEVENT_RESTORED ||
+                    event.window.event == SDL_WINDOWEVENT_EXPOSED)
+                    windowHidden = false;
+                redraw = true;
+                break;
+
+            case SDL_RENDER_TARGETS_RESET:
+            case SDL_RENDER_DEVICE_RESET:
+                layerValid = false;
+                lodValid = false;
+                minimapStale = true;
+                redraw = true;
+                break;
+
 			default:
 				break;
 		}
 	}
 }
 
-void drawGrid(SDL_Renderer* renderer, SDL_Texture* grassTexture, SDL_Texture* tomatoTexture, SDL_Texture* player1Texture, SDL_Texture* player2Texture, SDL_Texture* player3Texture, SDL_Texture* player4Texture)
+//connect and say hello ("j" to join, "r,<token>,<version>" to resume), false if the server is unreachable
+bool connectToServer(bool resume)
+{
+    char hello[64];
+    char *line;
+
+    if ((clientfd = open_clientfd(host, port)) < 0)
+        return false;
+    Rio_readinitb(&rio, clientfd);
+    Rio_writeinitb(&wio, clientfd);
+
+    if (resume)
+        sprintf(hello, "r,%016" PRIx64 ",%u\n", sessionToken, state.version);
+    else
+        strcpy(hello, "j\n");
+
+    if (rio_writen(clientfd, hello, strlen(hello)) < 0 || rio_readlinev(&rio, &line) <= 0) {
+        Close(clientfd);
+        return false;
+    }
+    if (line[0] == 'f') {
+        fprintf(stderr, "Server is full\n");
+        exit(EXIT_FAILURE);
+    }
+    sscanf(line, "t,%d,%" SCNx64 ",%d", &state.localPlayerId, &sessionToken, &tickMs);
+    return true;
+}
+
+//the connection dropped: resume the session, the server answers with only what changed
+void reconnect()
+{
+    Close(clientfd);
+    for (int attempt = 0; attempt < RECONNECT_ATTEMPTS && !shouldExit; attempt++) {
+        fprintf(stderr, "Connection lost, reconnecting (%d/%d)\n", attempt + 1, RECONNECT_ATTEMPTS);
+        SDL_Delay(RECONNECT_DELAY_MS);
+        if (connectToServer(true)) {
+            //the server may have restarted, and its clock with it
+            state.clockSynced = false;
+            state.historyCount = 0;
+            return;
+        }
+    }
+    if (shouldExit)
+        return;
+    fprintf(stderr, "Could not reconnect to %s:%s\n", host, port);
+    exit(EXIT_FAILURE);
+}
+
+//read a decimal int at *p and the comma after it, if any; false (and *p left alone) if there
+//is no number there or it doesn't fit an int
+bool readInt(const char **p, int *out)
+{
+    const char *q = *p;
+    bool negative = *q == '-';
+    long value = 0;
+
+    if (negative)
+        q++;
+    if (*q < '0' || *q > '9')
+        return false;
+    for (; *q >= '0' && *q <= '9'; q++) {
+        value = value * 10 + (*q - '0');
+        if (value > (long) INT_MAX + negative)
+            return false;
+    }
+    if (*q == ',')
+        q++;
+    *out = negative ? -value : value;
+    *p = q;
+    return true;
+}
+
+//apply "d,version,time,score,tomatoes,level,id,ack,x1,y1,..,x4,y4,count,(cell,tile)*" (every
+//update after the first state), count -1 means a new level and is followed by the packed board;
+//false and s untouched if the line is malformed
+bool applyDelta(GameState *s, const char *line)
 {
+    const char *p = line + 2;
+    int header[7], positions[8], count, cell, tile;
+
+    if (line[0] != 'd' || line[1] != ',')
+        return false;
+    for (int i = 0; i < 7; i++) {
+        if (!readInt(&p, &header[i]))
+            return false;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (!readInt(&p, &positions[i]) || positions[i] < -1 || positions[i] >= GRIDSIZE)
+            return false;
+    }
+    if (!readInt(&p, &count))
+        return false;
+
+    //check the changes before applying any of them
+    const char *changes = p;
+    for (int i = 0; i < count; i++) {
+        if (!readInt(&p, &cell) || !readInt(&p, &tile) || cell < 0 || cell >= GRIDSIZE * GRIDSIZE)
+            return false;
+    }
+    if (count >= 0 && *p != '\0')
+        return false;
+    if (count < 0) {
+        if (!terrainUnpack(&s->terrain, p))
+            return false;
+        densityLogReplaced(&s->terrainLog);
+    }
+
+    s->version = header[0];
+    s->serverMs = header[1];
+    s->score = header[2];
+    s->numTomatoes = header[3];
+    s->level = header[4];
+    s->localPlayerId = header[5];
+    s->inputAck = header[6];
+    for (int i = 0; i < 4; i++) {
+        s->players[i].x = positions[2 * i];
+        s->players[i].y = positions[2 * i + 1];
+        s->exists[i] = s->players[i].x >= 0;
+    }
+
+    for (p = changes; count > 0; count--) {
+        readInt(&p, &cell);
+        readInt(&p, &tile);
+        terrainPut(&s->terrain, cell % GRIDSIZE, cell / GRIDSIZE, tile == TILE_TOMATO);
+        densityLogCell(&s->terrainLog, cell % GRIDSIZE, cell / GRIDSIZE);
+    }
+    return true;
+}
+
+//apply a full state line: one entry per cell (0 grass, 1 tomato, p1-p4 a player), then score,
+//tomatoes, level, id and version; decoded in one pass, false and s untouched if it is malformed
+bool applyState(GameState *s, const char *line)
+{
+    //the network thread (or --headless) is the only caller, and a board can be too big for the stack
+    static Terrain terrain;
+    Position players[4];
+    bool exists[4] = {false};
+    int values[5];
+    const char *p = line;
+
+    terrainClear(&terrain);
+    for (int y = 0; y < GRIDSIZE; y++) {
+        for (int x = 0; x < GRIDSIZE; x++) {
+            switch (*p++) {
+                case '0':
+                    break;
+
+                case '1':
+                    terrainSetTomato(&terrain, x, y);
+                    break;
+
+                case 'p':
+                    if (*p < '1' || *p > '4')
+                        return false;
+                    players[*p - '1'] = (Position) {x, y};
+                    exists[*p - '1'] = true;
+                    p++;
+                    break;
+
+                default:
+                    return false;
+            }
+            if (*p++ != ',')
+                return false;
+        }
+    }
+
+    //score, tomatoes, level, id and version, and nothing after them
+    for (int i = 0; i < 5; i++) {
+        if (!readInt(&p, &values[i]))
+            return false;
+    }
+    if (*p != '\0')
+        return false;
+
+    memcpy(&s->terrain, &terrain, sizeof(Terrain));
+    densityLogReplaced(&s->terrainLog);
+    for (int i = 0; i < 4; i++) {
+        s->exists[i] = exists[i];
+        if (exists[i])
+            s->players[i] = players[i];
+    }
+    s->score = values[0];
+    s->numTomatoes = values[1];
+    s->level = values[2];
+    s->localPlayerId = values[3];
+    s->version = values[4];
+    return true;
+}
+
+//one axis of the camera: the board pixel at the view's edge with focus (in squares) in the
+//middle, kept on the board, or centring the board when it is smaller than the view
+int cameraEdge(float focus, int tilePx, int viewPx)
+{
+    int boardPx = GRIDSIZE * tilePx;
+    int edge = (int) (focus * tilePx) - viewPx / 2;
+
+    if (boardPx <= viewPx)
+        return (boardPx - viewPx) / 2;
+    if (edge < 0)
+        return 0;
+    if (edge > boardPx - viewPx)
+        return boardPx - viewPx;
+    return edge;
+}
+
+//point the camera at focus (the middle of a square, in squares) and work out which squares show
+void updateCamera(Camera* cam, float focusX, float focusY)
+{
+    cam->tilePx = zoomTilePx;
+    cam->left = cameraEdge(focusX, cam->tilePx, GRID_DRAW_WIDTH);
+    cam->top = cameraEdge(focusY, cam->tilePx, GRID_DRAW_HEIGHT);
+
+    cam->x0 = (cam->left > 0) ? cam->left / cam->tilePx : 0;
+    cam->y0 = (cam->top > 0) ? cam->top / cam->tilePx : 0;
+    cam->x1 = (cam->left + GRID_DRAW_WIDTH + cam->tilePx - 1) / cam->tilePx;
+    cam->y1 = (cam->top + GRID_DRAW_HEIGHT + cam->tilePx - 1) / cam->tilePx;
+    if (cam->x1 > GRIDSIZE)
+        cam->x1 = GRIDSIZE;
+    if (cam->y1 > GRIDSIZE)
+        cam->y1 = GRIDSIZE;
+}
+
+//queue square (x, y) of t, with the board's top left corner at (left, top)
+void drawCell(SDL_Renderer* renderer, const Terrain* t, int x, int y, int left, int top, int tilePx)
+{
+    SDL_Rect dest = {left + tilePx * x, top + tilePx * y, tilePx, tilePx};
+    spriteBatchAdd(&batch, renderer, terrainHasTomato(t, x, y) ? SPRITE_TOMATO : SPRITE_GRASS, &dest);
+}
+
+//bring terrainLayer up to date with the visible part of t: a full redraw when the camera
+//shows other squares or zoomed, otherwise only the squares whose bit differs from what the
+//layer shows. Only the 8x8 tiles in view are looked at, so the cost follows the screen size.
+void updateTerrainLayer(SDL_Renderer* renderer, const Terrain* t, const Camera* cam)
+{
+    bool full = !layerValid || cam->tilePx != layerView.tilePx || cam->x0 != layerView.x0 ||
+                cam->y0 != layerView.y0 || cam->x1 != layerView.x1 || cam->y1 != layerView.y1;
+    int left = -cam->x0 * cam->tilePx, top = -cam->y0 * cam->tilePx;
+    bool targetSet = false;
+
+    for (int ty = cam->y0 / 8; ty <= (cam->y1 - 1) / 8; ty++) {
+        for (int tx = cam->x0 / 8; tx <= (cam->x1 - 1) / 8; tx++) {
+            size_t w = (size_t) ty * TERRAIN_TILES_PER_ROW + tx;
+            uint64_t inView = terrainRectMask(tx, ty, cam->x0, cam->y0, cam->x1, cam->y1);
+            uint64_t dirty = (full ? ~(uint64_t) 0 : t->words[w] ^ layerTerrain.words[w]) & inView;
+
+            if (dirty != 0 && !targetSet) {
+                SDL_SetRenderTarget(renderer, terrainLayer);
+                spriteBatchBegin(&batch, &sprites);
+                targetSet = true;
+            }
+            while (dirty != 0) {
+                int x, y;
+                terrainCellOf(w * 64 + __builtin_ctzll(dirty), &x, &y);
+                drawCell(renderer, t, x, y, left, top, cam->tilePx);
+                dirty &= dirty - 1;
+            }
+            layerTerrain.words[w] = t->words[w];
+        }
+    }
+    if (targetSet) {
+        spriteBatchFlush(&batch, renderer);
+        SDL_SetRenderTarget(renderer, NULL);
+    }
+    layerView = *cam;
+    layerValid = true;
+}
+
+//ARGB of a block holding count of at most max tomatoes
+uint32_t densityColour(int count, int max)
+{
+    int r = grassColour.r + (tomatoColour.r - grassColour.r) * count / max;
+    int g = grassColour.g + (tomatoColour.g - grassColour.g) * count / max;
+    int b = grassColour.b + (tomatoColour.b - grassColour.b) * count / max;
+
+    return 0xff000000u | r << 16 | g << 8 | b;
+}
+
+//bring lodLayer up to date with the tiles in view, one texel per tile, when the counts
+//changed or the view reaches other tiles
+void updateLodLayer(const Camera* cam, bool densityChanged)
+{
+    SDL_Rect tiles = {cam->x0 / 8, cam->y0 / 8, 0, 0};
+    tiles.w = (cam->x1 + 7) / 8 - tiles.x;
+    tiles.h = (cam->y1 + 7) / 8 - tiles.y;
+
+    if (lodValid && !densityChanged && SDL_RectEquals(&tiles, &lodTiles))
+        return;
+    for (int ty = 0; ty < tiles.h; ty++) {
+        for (int tx = 0; tx < tiles.w; tx++)
+            lodPixels[ty * LOD_TEXELS + tx] = densityColour(densityTile(&density, tiles.x + tx, tiles.y + ty), DENSITY_TILE_MAX);
+    }
+    SDL_UpdateTexture(lodLayer, &(SDL_Rect) {0, 0, tiles.w, tiles.h}, lodPixels, LOD_TEXELS * sizeof(uint32_t));
+    lodTiles = tiles;
+    lodValid = true;
+}
+
+//the visible terrain (one copy of the layer, or of the zoomed out layer when squares are
+//too small for sprites) and the players in view on top, as one sprite batch
+void drawGrid(SDL_Renderer* renderer, const GameState* s, const DrawPos* drawn, const Camera* cam, bool densityChanged)
+{
+    SDL_Rect view = {0, HEADER_HEIGHT, GRID_DRAW_WIDTH, GRID_DRAW_HEIGHT};
+    int left = view.x - cam->left, top = view.y - cam->top; // where the board's corner is on screen
+    SDL_Rect board = {left, top, GRIDSIZE * cam->tilePx, GRIDSIZE * cam->tilePx};
+    bool zoomedOut = cam->tilePx < LOD_TILE_PX && lodLayer != NULL;
+    int marker = (cam->tilePx < MARKER_PX) ? MARKER_PX : cam->tilePx;
+    SDL_Rect dest;
+
+    //squares partly in view must not spill into the header, nor blocks past the board's edge
+    SDL_IntersectRect(&view, &board, &view);
+    SDL_RenderSetClipRect(renderer, &view);
+    if (zoomedOut) {
+        updateLodLayer(cam, densityChanged);
+        int blockPx = 8 * cam->tilePx;
+        SDL_Rect src = {0, 0, lodTiles.w, lodTiles.h};
+        dest = (SDL_Rect) {left + lodTiles.x * blockPx, top + lodTiles.y * blockPx, lodTiles.w * blockPx, lodTiles.h * blockPx};
+        SDL_RenderCopy(renderer, lodLayer, &src, &dest);
+    } else if (terrainLayer != NULL) {
+        updateTerrainLayer(renderer, &s->terrain, cam);
+        SDL_Rect src = {0, 0, (cam->x1 - cam->x0) * cam->tilePx, (cam->y1 - cam->y0) * cam->tilePx};
+        dest = (SDL_Rect) {left + cam->x0 * cam->tilePx, top + cam->y0 * cam->tilePx, src.w, src.h};
+        SDL_RenderCopy(renderer, terrainLayer, &src, &dest);
+    }
+
+    spriteBatchBegin(&batch, &sprites);
+    if (terrainLayer == NULL && !zoomedOut) {
+        for (int j = cam->y0; j < cam->y1; j++) {
+            for (int i = cam->x0; i < cam->x1; i++)
+                drawCell(renderer, &s->terrain, i, j, left, top, cam->tilePx);
+        }
+    }
+
+    //players go over the grass, those out of view are skipped
+    for (int i = 0; i < 4; i++) {
+        if (!drawn[i].visible || drawn[i].x + 1 <= cam->x0 || drawn[i].x >= cam->x1 ||
+            drawn[i].y + 1 <= cam->y0 || drawn[i].y >= cam->y1)
+            continue;
+        dest.x = left + (int) (cam->tilePx * drawn[i].x + 0.5f) + (cam->tilePx - marker) / 2;
+        dest.y = top + (int) (cam->tilePx * drawn[i].y + 0.5f) + (cam->tilePx - marker) / 2;
+        dest.w = dest.h = marker;
+        spriteBatchAdd(&batch, renderer, SPRITE_PLAYER1 + i, &dest);
+    }
+    spriteBatchFlush(&batch, renderer);
+    SDL_RenderSetClipRect(renderer, NULL);
+}
+
+//redraw the minimap's terrain from the cells, tiles or blocks, whichever MINIMAP_UNIT is
+void updateMinimap(const Terrain* t)
+{
+    for (int y = 0; y < MINIMAP_TEXELS; y++) {
+        for (int x = 0; x < MINIMAP_TEXELS; x++) {
+#if MINIMAP_UNIT == 1
+            uint32_t colour = densityColour(terrainHasTomato(t, x, y), 1);
+#elif MINIMAP_UNIT == 8
+            uint32_t colour = densityColour(densityTile(&density, x, y), DENSITY_TILE_MAX);
+#else
+            uint32_t colour = densityColour(densityBlock(&density, x, y), DENSITY_BLOCK_MAX);
+#endif
+            minimapPixels[y * MINIMAP_TEXELS + x] = colour;
+        }
+    }
+    SDL_UpdateTexture(minimap, NULL, minimapPixels, MINIMAP_TEXELS * sizeof(uint32_t));
+}
+
+//the whole board in the corner: terrain refreshed at most every MINIMAP_REFRESH_MS,
+//players and the outline of the view every frame
+void drawMinimap(SDL_Renderer* renderer, const GameState* s, const DrawPos* drawn, const Camera* cam, uint32_t now)
+{
+    SDL_Rect map = {GRID_DRAW_WIDTH - MINIMAP_SIZE - MINIMAP_MARGIN, HEADER_HEIGHT + GRID_DRAW_HEIGHT - MINIMAP_SIZE - MINIMAP_MARGIN,
+                    MINIMAP_SIZE, MINIMAP_SIZE};
+    float scale = (float) MINIMAP_SIZE / GRIDSIZE; // minimap pixels per square
+    int terrainPx = (int) (MINIMAP_TEXELS * MINIMAP_UNIT * scale + 0.5f); // texels may run past the board's edge
     SDL_Rect dest;
-    for (int i = 0; i < GRIDSIZE; i++) {
-        for (int j = 0; j < GRIDSIZE; j++) {
-            dest.x = 64 * i;
-            dest.y = 64 * j + HEADER_HEIGHT;
-            SDL_Texture* texture = (grid[i][j] == TILE_GRASS) ? grassTexture : tomatoTexture;
-            SDL_QueryTexture(texture, NULL, NULL, &dest.w, &dest.h);
-            SDL_RenderCopy(renderer, texture, NULL, &dest);
+
+    if (minimapStale && now - minimapDrawnAt >= MINIMAP_REFRESH_MS) {
+        updateMinimap(&s->terrain);
+        minimapStale = false;
+        minimapDrawnAt = now;
+    }
+
+    SDL_RenderSetClipRect(renderer, &map);
+    dest = (SDL_Rect) {map.x, map.y, terrainPx, terrainPx};
+    SDL_RenderCopy(renderer, minimap, NULL, &dest);
+
+    spriteBatchBegin(&batch, &sprites);
+    for (int i = 0; i < 4; i++) {
+        if (!drawn[i].visible)
+            continue;
+        dest.w = dest.h = (scale < 4) ? 4 : (int) scale;
+        dest.x = map.x + (int) ((drawn[i].x + 0.5f) * scale) - dest.w / 2;
+        dest.y = map.y + (int) ((drawn[i].y + 0.5f) * scale) - dest.h / 2;
+        spriteBatchAdd(&batch, renderer, SPRITE_PLAYER1 + i, &dest);
+    }
+    spriteBatchFlush(&batch, renderer);
+
+    float viewScale = (float) MINIMAP_SIZE / (GRIDSIZE * cam->tilePx);
+    dest = (SDL_Rect) {map.x + (int) (cam->left * viewScale), map.y + (int) (cam->top * viewScale),
+                       (int) (GRID_DRAW_WIDTH * viewScale) + 1, (int) (GRID_DRAW_HEIGHT * viewScale) + 1};
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawRect(renderer, &dest);
+    SDL_RenderSetClipRect(renderer, NULL);
+    SDL_RenderDrawRect(renderer, &map);
+}
+
+//move *value at most limit away from center
+float clampAround(float value, float center, float limit)
+{
+    if (value > center + limit)
+        return center + limit;
+    if (value < center - limit)
+        return center - limit;
+    return value;
+}
+
+//draw everyone as they were at renderAt (server time): between the two snapshots around it,
+//or a little past the newest one when updates are late
+void interpolatePlayers(const GameState *s, DrawPos *drawn, int renderAt)
+{
+    int newest = s->historyCount - 1;
+    int k = newest;
+
+    while (k > 0 && snapshotAt(s, k)->serverMs > renderAt)
+        k--;
+    const Snapshot *a = snapshotAt(s, k);
+
+    for (int i = 0; i < 4; i++) {
+        drawn[i].x = a->players[i].x;
+        drawn[i].y = a->players[i].y;
+        drawn[i].visible = a->exists[i];
+    }
+
+    if (k < newest) {
+        const Snapshot *b = snapshotAt(s, k + 1);
+        float t = (float) (renderAt - a->serverMs) / (b->serverMs - a->serverMs);
+        if (t < 0)
+            t = 0;
+        for (int i = 0; i < 4; i++) {
+            int dx = b->players[i].x - a->players[i].x;
+            int dy = b->players[i].y - a->players[i].y;
+            if (a->exists[i] && b->exists[i] && abs(dx) + abs(dy) <= SNAP_DISTANCE) {
+                drawn[i].x += dx * t;
+                drawn[i].y += dy * t;
+            }
         }
     }
+    else if (k > 0 && renderAt > a->serverMs && a->serverMs > snapshotAt(s, k - 1)->serverMs) {
+        const Snapshot *prev = snapshotAt(s, k - 1);
+        int late = renderAt - a->serverMs;
+        float t = (float) (late < EXTRAPOLATE_MS ? late : EXTRAPOLATE_MS) / (a->serverMs - prev->serverMs);
+        for (int i = 0; i < 4; i++) {
+            int dx = a->players[i].x - prev->players[i].x;
+            int dy = a->players[i].y - prev->players[i].y;
+            if (a->exists[i] && prev->exists[i] && abs(dx) + abs(dy) <= 1) {
+                drawn[i].x = clampAround(drawn[i].x + dx * t, a->players[i].x, EXTRAPOLATE_SQUARES);
+                drawn[i].y = clampAround(drawn[i].y + dy * t, a->players[i].y, EXTRAPOLATE_SQUARES);
+            }
+        }
+    }
+}
 
-    //creating player texture (override the grass texture)
-    if (p1Exist) {
-        dest.x = 64 * player1.x;
-        dest.y = 64 * player1.y + HEADER_HEIGHT;
-        SDL_QueryTexture(player1Texture, NULL, NULL, &dest.w, &dest.h);
-        SDL_RenderCopy(renderer, player1Texture, NULL, &dest);
+//where to draw each player this frame: the local player shows moves at once and eases
+//toward the right square after a correction, the others are interpolated a little in the past
+void placePlayers(GameState *s, DrawPos *drawn, uint32_t now, uint32_t elapsedMs)
+{
+    Position *me = localPlayer(s);
+
+    if (s->clockSynced && s->historyCount > 0)
+        interpolatePlayers(s, drawn, (int) (now - s->clockOffset) - interpDelayMs);
+    else {
+        for (int i = 0; i < 4; i++) {
+            drawn[i].x = s->players[i].x;
+            drawn[i].y = s->players[i].y;
+            drawn[i].visible = s->exists[i];
+        }
     }
-    if (p2Exist) {
-        dest.x = 64 * player2.x;
-        dest.y = 64 * player2.y + HEADER_HEIGHT;
-        SDL_QueryTexture(player2Texture, NULL, NULL, &dest.w, &dest.h);
-        SDL_RenderCopy(renderer, player2Texture, NULL, &dest);
+    if (me == NULL || !s->exists[s->localPlayerId - 1])
+        return;
+
+    float dx = me->x - localDraw.x;
+    float dy = me->y - localDraw.y;
+    if (s->corrections != seenCorrections) {
+        seenCorrections = s->corrections;
+        localEasing = true;
     }
-    if (p3Exist) {
-        dest.x = 64 * player3.x;
-        dest.y = 64 * player3.y + HEADER_HEIGHT;
-        SDL_QueryTexture(player3Texture, NULL, NULL, &dest.w, &dest.h);
-        SDL_RenderCopy(renderer, player3Texture, NULL, &dest);
+    if (!localDrawPlaced || !localEasing || fabsf(dx) + fabsf(dy) > SNAP_DISTANCE) {
+        localDraw.x = me->x;
+        localDraw.y = me->y;
+        localDraw.visible = true;
+        localDrawPlaced = true;
+        localEasing = false;
     }
-    if (p4Exist) {
-        dest.x = 64 * player4.x;
-        dest.y = 64 * player4.y + HEADER_HEIGHT;
-        SDL_QueryTexture(player4Texture, NULL, NULL, &dest.w, &dest.h);
-        SDL_RenderCopy(renderer, player4Texture, NULL, &dest);
+    else {
+        float step = (elapsedMs >= CORRECTION_MS) ? 1.0f : (float) elapsedMs / CORRECTION_MS;
+        localDraw.x += dx * step;
+        localDraw.y += dy * step;
+        if (fabsf(me->x - localDraw.x) + fabsf(me->y - localDraw.y) < 0.02f) {
+            localDraw.x = me->x;
+            localDraw.y = me->y;
+            localEasing = false;
+        }
     }
+    drawn[s->localPlayerId - 1] = localDraw;
 }
 
-void drawUI(SDL_Renderer* renderer)
+//score on the left and level on the right, laid out again only when the numbers change
+void drawUI(SDL_Renderer* renderer, const GameState* s)
 {
     // largest score/level supported is 2147483647
-    char scoreStr[18];
-    char levelStr[18];
-    sprintf(scoreStr, "Score: %d", score);
-    sprintf(levelStr, "Level: %d", level);
+    char text[18];
+
+    if (!hudLaidOut || s->score != hudScore) {
+        sprintf(text, "Score: %d", s->score);
+        textLayoutSet(&scoreText, &hudGlyphs, text);
+        hudScore = s->score;
+    }
+    if (!hudLaidOut || s->level != hudLevel) {
+        sprintf(text, "Level: %d", s->level);
+        textLayoutSet(&levelText, &hudGlyphs, text);
+        hudLevel = s->level;
+    }
+    hudLaidOut = true;
+
+    textLayoutDraw(renderer, &hudGlyphs, &scoreText, 0, 0);
+    textLayoutDraw(renderer, &hudGlyphs, &levelText, GRID_DRAW_WIDTH - levelText.width, 0);
+}
+
+//remember where everyone is at the update's server time; the server only pushes changes,
+//so the previous positions are repeated a tick earlier to hold them until just before this one
+void recordSnapshot(GameState *s, uint32_t receivedAt)
+{
+    int offset = (int) receivedAt - s->serverMs;
+    Snapshot snap;
+
+    if (!s->clockSynced || offset < s->clockOffset) {
+        s->clockOffset = offset;
+        s->clockSynced = true;
+    }
+    if (s->historyCount > 0) {
+        snap = *snapshotAt(s, s->historyCount - 1);
+        if (snap.serverMs < s->serverMs - tickMs) {
+            snap.serverMs = s->serverMs - tickMs;
+            pushSnapshot(s, &snap);
+        }
+    }
+    snap.serverMs = s->serverMs;
+    memcpy(snap.players, s->players, sizeof(snap.players));
+    memcpy(snap.exists, s->exists, sizeof(snap.exists));
+    pushSnapshot(s, &snap);
+}
+
+//hand the render thread the server's state with our unacknowledged moves replayed on top
+void publishState(bool fromServer)
+{
+    GameState *out = tbuf_back(&published);
+    Position *me;
+
+    memcpy(out, &state, sizeof(GameState));
+    for (int i = 0; i < numPending; i++) {
+        if ((me = localPlayer(out)) != NULL)
+            moveTo(out, me->x + moveDx[pending[i].move], me->y + moveDy[pending[i].move]);
+    }
+
+    //only our own moves should move us, anything else the server did is a misprediction
+    if ((me = localPlayer(out)) != NULL) {
+        if (fromServer && (me->x != shown.x || me->y != shown.y))
+            corrections++;
+        shown = *me;
+    }
+    out->corrections = corrections;
+    tbuf_publish(&published);
+
+    //wake the render loop in case it is idling (there is none to wake in --headless)
+    if (stateEvent != 0) {
+        SDL_Event wake = {.type = stateEvent};
+        SDL_PushEvent(&wake);
+    }
+}
+
+//forget the moves the server has processed (a full state means a new session, nothing will be acked)
+void dropAcked(bool fullState)
+{
+    int kept = 0;
+
+    for (int i = 0; i < numPending && !fullState; i++) {
+        if (pending[i].seq > state.inputAck)
+            pending[kept++] = pending[i];
+        else {
+            state.confirmedSeq = pending[i].seq;
+            state.confirmedKeyMs = pending[i].keyMs;
+        }
+    }
+    numPending = kept;
+}
+
+//queue n bytes for the server (flushed by the caller)
+void sendLine(char *msg, size_t n)
+{
+    rio_writeb(&wio, msg, n);
+    netStats.bytesOut += n;
+}
+
+//send a pending move as "m,seq,dx,dy" (flushed by the caller)
+void writeMove(PendingMove *m)
+{
+    char msg[32];
+
+    sendLine(msg, sprintf(msg, "m,%u,%d,%d\n", m->seq, moveDx[m->move], moveDy[m->move]));
+}
+
+//number and send every queued move in one write and show it right away;
+//returns whether anything was sent (a failed write shows up as EOF on the next read)
+bool sendMoves()
+{
+    int move, keyMs;
+    bool sent = false;
+
+    // a full pending list means the server is far behind, drop the key press
+    while (spsc_pop(&inputs, &move)) {
+        spsc_pop(&inputTimes, &keyMs);
+        if (numPending == MAX_PENDING_MOVES)
+            continue;
+        pending[numPending].seq = ++lastSeq;
+        pending[numPending].move = move;
+        pending[numPending].keyMs = keyMs;
+        writeMove(&pending[numPending++]);
+        sent = true;
+    }
+    if (sent) {
+        publishState(false);
+        rio_flushb(&wio);
+    }
+    return sent;
+}
+
+//read one line from the server: a view into rio's buffer, or on big boards, where a full
+//state or packed board is longer than that, the pieces rio returns joined in longLine;
+//valid until the next call. Same return values as rio_readlinev
+ssize_t readLine(char **linep)
+{
+    static char *longLine; // LINE_MAX_BYTES + 1, allocated for the first long line
+    size_t length = 0, total = 0;
+    ssize_t n;
+
+    while ((n = rio_readlinev(&rio, linep)) > 0) {
+        //a piece that fills rio's buffer without a newline continues in the next one
+        bool more = n == RIO_BUFSIZE && strlen(*linep) == RIO_BUFSIZE;
+        if (!more && length == 0)
+            return n;
+
+        size_t piece = more ? RIO_BUFSIZE : strlen(*linep);
+        if (length + piece > LINE_MAX_BYTES) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        if (longLine == NULL && (longLine = malloc(LINE_MAX_BYTES + 1)) == NULL) {
+            fprintf(stderr, "Out of memory for a long line\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(longLine + length, *linep, piece + 1);
+        length += piece;
+        total += n;
+        if (!more) {
+            *linep = longLine;
+            return total;
+        }
+    }
+    return n;
+}
+
+//take in a full state or a delta from the server and publish the result; a malformed line
+//is reported and dropped
+void applyLine(const char *line, uint32_t receivedAt)
+{
+    //a full state has no server time, others are drawn as is until the first update
+    bool fullState = line[0] != 'd';
+    if (!(fullState ? applyState(&state, line) : applyDelta(&state, line))) {
+        fprintf(stderr, "Malformed %s from server: %.60s\n", fullState ? "state" : "update", line);
+        return;
+    }
+    if (fullState)
+        state.historyCount = 0;
+    else
+        recordSnapshot(&state, receivedAt);
+    dropAcked(fullState);
+    publishState(true);
+}
+
+//network thread: owns the socket, applies every line the server pushes to state and
+//publishes it, sends moves as soon as they are queued and a keepalive when idle,
+//so a slow server never stalls a frame
+void *networkThread(void *vargp)
+{
+    char drain[INPUT_QUEUE_SIZE];
+    char *line, ping[24];
+    ssize_t n;
+    uint32_t lastSent = SDL_GetTicks();
+    uint32_t lastHeard = lastSent;
+    uint32_t lastPing = lastSent;
+    bool resend = false; // after a resume, moves the server never saw go out again
+
+    while (!shouldExit) {
+        //lines rio has already buffered don't show up in poll
+        if (rio.rio_cnt <= 0) {
+            struct pollfd fds[2] = {{clientfd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+            uint32_t now = SDL_GetTicks();
+            int untilKeepalive = KEEPALIVE_MS - (int) (now - lastSent);
+            int untilTimeout = KEEPALIVE_TIMEOUT_MS - (int) (now - lastHeard);
+            int untilPing = PING_MS - (int) (now - lastPing);
+            int timeout = untilKeepalive < untilTimeout ? untilKeepalive : untilTimeout;
+            if (untilPing < timeout)
+                timeout = untilPing;
+
+            poll(fds, 2, timeout > 0 ? timeout : 0);
+            if (fds[1].revents & POLLIN)
+                read(wakeFds[0], drain, sizeof(drain));
+
+            uint64_t traceStep = TRACE_START();
+            now = SDL_GetTicks();
+            if (sendMoves())
+                lastSent = now;
+            if (now - lastPing >= PING_MS) {
+                //a ping keeps the connection alive too
+                sendLine(ping, sprintf(ping, "p,%u\n", now));
+                rio_flushb(&wio);
+                lastSent = lastPing = now;
+            }
+            else if (now - lastSent >= KEEPALIVE_MS) {
+                sendLine("k\n", 2);
+                rio_flushb(&wio);
+                lastSent = now;
+            }
+            TRACE_END("send", traceStep);
+
+            if (now - lastHeard >= KEEPALIVE_TIMEOUT_MS) {
+                fprintf(stderr, "Server went quiet\n");
+                reconnect();
+                resend = true;
+                lastSent = lastHeard = SDL_GetTicks();
+                continue;
+            }
+            if (fds[0].revents == 0)
+                continue;
+        }
+
+        uint64_t traceStep = TRACE_START();
+        if ((n = readLine(&line)) <= 0) {
+            if (!shouldExit)
+                reconnect();
+            resend = true;
+            lastSent = lastHeard = SDL_GetTicks();
+            continue;
+        }
+        lastHeard = SDL_GetTicks();
+        netStats.bytesIn += n;
+        TRACE_END("receive", traceStep);
+        if (line[0] == 'k')
+            continue;
+        if (line[0] == 'q') {
+            netStats.rttMs = lastHeard - (uint32_t) strtoul(line + 2, NULL, 10);
+            continue;
+        }
+
+        if (recordFile != NULL)
+            fprintf(recordFile, "%u %s\n", lastHeard, line);
+
+        //line points into rio's buffer (or readLine's)
+        traceStep = TRACE_START();
+        uint64_t parseStart = pacerNow();
+        applyLine(line, lastHeard);
+        netStats.parseNs += pacerNow() - parseStart;
+        netStats.updates++;
+        TRACE_END("parse", traceStep);
+
+        if (resend && numPending > 0) {
+            for (int i = 0; i < numPending; i++)
+                writeMove(&pending[i]);
+            rio_flushb(&wio);
+            lastSent = SDL_GetTicks();
+        }
+        resend = false;
+    }
+    return NULL;
+}
+
+//render thread: a frame drawn from s was just presented; if s is the first to show the
+//server's answer to a move, that move's key to photon time is known now
+void notePresented(const GameState *s, uint32_t presentedAt)
+{
+    if (s->confirmedSeq <= perf.measuredSeq)
+        return;
+    perf.measuredSeq = s->confirmedSeq;
+    perf.keyToPhotonMs = presentedAt - s->confirmedKeyMs;
+    perf.keyToPhotonSum += perf.keyToPhotonMs;
+    perf.keyToPhotonCount++;
+    if (perf.keyToPhotonMs > perf.keyToPhotonMax)
+        perf.keyToPhotonMax = perf.keyToPhotonMs;
+}
+
+//every PERF_SAMPLE_MS: rates since the last sample, into the overlay's text and a PERF_CSV row
+void samplePerf(uint32_t now)
+{
+    uint32_t elapsed = now - perf.sampledAt;
+    char text[TEXT_LAYOUT_MAX + 1];
+    PacerStats stats;
+
+    if (elapsed < PERF_SAMPLE_MS || (!perf.shown && perf.csv == NULL))
+        return;
+
+    uint64_t bytesIn = netStats.bytesIn, bytesOut = netStats.bytesOut;
+    uint64_t updates = netStats.updates, parseNs = netStats.parseNs;
+    float seconds = elapsed / 1000.0f;
+    float fps = (pacer.frames - perf.frames) / seconds;
+    float inRate = (bytesIn - perf.bytesIn) / seconds, outRate = (bytesOut - perf.bytesOut) / seconds;
+    float updateRate = (updates - perf.updates) / seconds;
+    float parseUs = (updates > perf.updates) ? (parseNs - perf.parseNs) / 1000.0f / (updates - perf.updates) : 0;
+    int rtt = netStats.rttMs;
+    pacerStats(&pacer, &stats);
+
+    snprintf(text, sizeof(text), "%.0f fps %.1f ms p99 %.1f", fps, stats.avgMs, stats.p99Ms);
+    textLayoutSet(&perf.lines[0], &perfGlyphs, text);
+    snprintf(text, sizeof(text), "draw %.2f ms parse %.1f us", stats.avgWorkMs, parseUs);
+    textLayoutSet(&perf.lines[1], &perfGlyphs, text);
+    if (rtt >= 0)
+        snprintf(text, sizeof(text), "rtt %d ms tick %d ms %.0f/s", rtt, tickMs, updateRate);
+    else
+        snprintf(text, sizeof(text), "rtt - tick %d ms %.0f/s", tickMs, updateRate);
+    textLayoutSet(&perf.lines[2], &perfGlyphs, text);
+    snprintf(text, sizeof(text), "in %.1f KB/s out %.1f KB/s", inRate / 1024, outRate / 1024);
+    textLayoutSet(&perf.lines[3], &perfGlyphs, text);
+    if (perf.measuredSeq > 0)
+        snprintf(text, sizeof(text), "key to photon %d ms", perf.keyToPhotonMs);
+    else
+        snprintf(text, sizeof(text), "key to photon -");
+    textLayoutSet(&perf.lines[4], &perfGlyphs, text);
+
+    if (perf.csv != NULL) {
+        fprintf(perf.csv, "%u,%.1f,%.2f,%.2f,%.2f,%.2f,%d,%.1f,%.0f,%.0f,", now, fps, stats.avgMs, stats.p99Ms,
+                stats.avgWorkMs, parseUs, rtt, updateRate, inRate, outRate);
+        if (perf.keyToPhotonCount > 0)
+            fprintf(perf.csv, "%.1f,%d,%d\n", (float) perf.keyToPhotonSum / perf.keyToPhotonCount,
+                    perf.keyToPhotonMax, perf.keyToPhotonCount);
+        else
+            fprintf(perf.csv, ",,0\n");
+        fflush(perf.csv);
+    }
+
+    perf.sampledAt = now;
+    perf.frames = pacer.frames;
+    perf.bytesIn = bytesIn;
+    perf.bytesOut = bytesOut;
+    perf.updates = updates;
+    perf.parseNs = parseNs;
+    perf.keyToPhotonSum = perf.keyToPhotonMax = perf.keyToPhotonCount = 0;
+    redraw = redraw || perf.shown;
+}
+
+//the overlay in the top left corner of the grid: the figures, and the last frame times as
+//bars (red past 1.5 frame periods) with the period marked
+void drawPerf(SDL_Renderer* renderer)
+{
+    SDL_Rect ok[PERF_GRAPH_FRAMES], late[PERF_GRAPH_FRAMES];
+    int numOk = 0, numLate = 0;
+    int lineHeight = perfGlyphs.height;
+    SDL_Rect panel = {8, HEADER_HEIGHT + 8, PERF_GRAPH_FRAMES * PERF_GRAPH_BAR + 16, PERF_LINES * lineHeight + PERF_GRAPH_HEIGHT + 24};
+    float periodMs = pacer.periodNs ? pacer.periodNs / 1e6f : 1000.0f / DEFAULT_FPS;
+    float pxPerMs = PERF_GRAPH_HEIGHT / (2 * periodMs); // the period is half way up
+    int base = panel.y + panel.h - 8;                   // bottom of the graph
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 170);
+    SDL_RenderFillRect(renderer, &panel);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+
+    for (int i = 0; i < PERF_LINES; i++)
+        textLayoutDraw(renderer, &perfGlyphs, &perf.lines[i], panel.x + 8, panel.y + 8 + i * lineHeight);
+
+    //oldest on the left
+    for (int i = 0; i < PERF_GRAPH_FRAMES; i++) {
+        float ms = pacerInterval(&pacer, PERF_GRAPH_FRAMES - 1 - i);
+        int height = (ms * pxPerMs > PERF_GRAPH_HEIGHT) ? PERF_GRAPH_HEIGHT : (int) (ms * pxPerMs + 0.5f);
+        SDL_Rect bar = {panel.x + 8 + i * PERF_GRAPH_BAR, base - height, PERF_GRAPH_BAR, height};
+        if (ms > 1.5f * periodMs)
+            late[numLate++] = bar;
+        else
+            ok[numOk++] = bar;
+    }
+    SDL_SetRenderDrawColor(renderer, 80, 220, 80, 255);
+    SDL_RenderFillRects(renderer, ok, numOk);
+    SDL_SetRenderDrawColor(renderer, 230, 60, 50, 255);
+    SDL_RenderFillRects(renderer, late, numLate);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawLine(renderer, panel.x + 8, base - PERF_GRAPH_HEIGHT / 2, panel.x + 8 + PERF_GRAPH_FRAMES * PERF_GRAPH_BAR, base - PERF_GRAPH_HEIGHT / 2);
+}
+
+//whether a frame would look the same as the one on screen
+bool sameView(const DrawPos* drawn, const DrawPos* shownDrawn, const Camera* cam, const Camera* shownCam)
+{
+    for (int i = 0; i < 4; i++) {
+        if (drawn[i].visible != shownDrawn[i].visible)
+            return false;
+        if (drawn[i].visible && (drawn[i].x != shownDrawn[i].x || drawn[i].y != shownDrawn[i].y))
+            return false;
+    }
+    return cam->tilePx == shownCam->tilePx && cam->left == shownCam->left && cam->top == shownCam->top;
+}
+
+void printFrameStats()
+{
+    PacerStats stats;
+
+    pacerStats(&pacer, &stats);
+    fprintf(stderr, "frames: %d, avg %.2f ms, p99 %.2f ms, max %.2f ms, late %d, drawing %.2f ms\n",
+            stats.frames, stats.avgMs, stats.p99Ms, stats.maxMs, stats.late, stats.avgWorkMs);
+}
+
+//the file from resources/ built in as name, there is no going on without it
+const Asset *needAsset(const char *name)
+{
+    const Asset *asset = assetFind(name);
+    if (asset == NULL) {
+        fprintf(stderr, "%s was not built into the client\n", name);
+        exit(EXIT_FAILURE);
+    }
+    return asset;
+}
+
+//start decoding the sprite images on worker threads, to be picked up by loadResources()
+void startSpriteDecode()
+{
+    const char *const names[NUM_SPRITES] = {
+        "grass.png", "tomato.png", "player1.png", "player2.png", "player3.png", "player4.png"
+    };
+    const void *pngs[NUM_SPRITES];
+    size_t sizes[NUM_SPRITES];
+
+    int rv = IMG_Init(IMG_INIT_PNG);
+    if ((rv & IMG_INIT_PNG) != IMG_INIT_PNG) {
+        fprintf(stderr, "Error initializing IMG: %s\n", IMG_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        const Asset *asset = needAsset(names[i]);
+        pngs[i] = asset->data;
+        sizes[i] = asset->size;
+    }
+    spriteDecodeStart(&spriteDecode, pngs, sizes);
+}
+
+//sprites, HUD glyphs and the layers the grid is drawn through, for renderer
+void loadResources(SDL_Renderer* renderer)
+{
+    const Asset *fontFile = needAsset("Burbank-Big-Condensed-Bold-Font.otf");
+    font = TTF_OpenFontRW(SDL_RWFromConstMem(fontFile->data, fontFile->size), 1, HEADER_HEIGHT);
+    if (font == NULL) {
+        fprintf(stderr, "Error loading font: %s\n", TTF_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    if (!spriteAtlasUpload(&sprites, renderer, &spriteDecode)) {
+        fprintf(stderr, "Error loading sprites: %s\n", IMG_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    if (SDL_RenderTargetSupported(renderer))
+        terrainLayer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, LAYER_WIDTH, LAYER_HEIGHT);
+    //without these zooming out stops at LOD_TILE_PX and the minimap stays hidden
+    lodLayer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, LOD_TEXELS, LOD_TEXELS);
+    minimap = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, MINIMAP_TEXELS, MINIMAP_TEXELS);
+    densityInit(&density);
 
     SDL_Color white = {255, 255, 255};
-    SDL_Surface* scoreSurface = TTF_RenderText_Solid(font, scoreStr, white);
-    SDL_Texture* scoreTexture = SDL_CreateTextureFromSurface(renderer, scoreSurface);
+    if (!glyphAtlasInit(&hudGlyphs, renderer, font, white)) {
+        fprintf(stderr, "Error building HUD glyphs: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
 
-    SDL_Surface* levelSurface = TTF_RenderText_Solid(font, levelStr, white);
-    SDL_Texture* levelTexture = SDL_CreateTextureFromSurface(renderer, levelSurface);
+    perfFont = TTF_OpenFontRW(SDL_RWFromConstMem(fontFile->data, fontFile->size), 1, PERF_FONT_SIZE);
+    if (perfFont == NULL || !glyphAtlasInit(&perfGlyphs, renderer, perfFont, white)) {
+        fprintf(stderr, "Error building overlay glyphs: %s\n", TTF_GetError());
+        exit(EXIT_FAILURE);
+    }
+}
+
+void freeResources()
+{
+    spriteAtlasFree(&sprites);
+
+    glyphAtlasFree(&hudGlyphs);
+    if (terrainLayer != NULL)
+        SDL_DestroyTexture(terrainLayer);
+    if (lodLayer != NULL)
+        SDL_DestroyTexture(lodLayer);
+    if (minimap != NULL)
+        SDL_DestroyTexture(minimap);
+    glyphAtlasFree(&perfGlyphs);
+    TTF_CloseFont(perfFont);
+    TTF_CloseFont(font);
+}
+
+//a made-up game for --headless without a recording: four players wandering over a
+//board that gains a few tomatoes every tick and starts a new level now and then
+typedef struct
+{
+    Terrain board;
+    Position players[4];
+    int version;
+    int serverMs;
+    int score;
+    int level;
+    unsigned seed;
+} Synthetic;
+
+//a quarter of the squares get a tomato
+void syntheticLevel(Synthetic *g)
+{
+    for (int ty = 0; ty < TERRAIN_TILES_PER_ROW; ty++) {
+        for (int tx = 0; tx < TERRAIN_TILES_PER_ROW; tx++) {
+            uint64_t bits = 0;
+            for (int i = 0; i < 4; i++)
+                bits = bits << 16 | (rand_r(&g->seed) & 0xffff);
+            g->board.words[ty * TERRAIN_TILES_PER_ROW + tx] =
+                bits & (bits >> 1) & terrainRectMask(tx, ty, 0, 0, GRIDSIZE, GRIDSIZE);
+        }
+    }
+    g->level++;
+}
+
+//the next update as the server would send it, a delta with a packed board on a new level
+void syntheticUpdate(Synthetic *g, char *line)
+{
+    int changes[4 + SYNTH_NEW_TOMATOES][2];
+    int numChanges = 0;
+    bool newLevel = g->version == 0 || g->version % SYNTH_LEVEL_TICKS == 0;
+
+    if (newLevel)
+        syntheticLevel(g);
+
+    for (int i = 0; i < 4 && !newLevel; i++) {
+        int move = rand_r(&g->seed) % 4;
+        int x = g->players[i].x + moveDx[move], y = g->players[i].y + moveDy[move];
+        if (x < 0 || x >= GRIDSIZE || y < 0 || y >= GRIDSIZE)
+            continue;
+        g->players[i].x = x;
+        g->players[i].y = y;
+        if (terrainTakeTomato(&g->board, x, y)) {
+            changes[numChanges][0] = y * GRIDSIZE + x;
+            changes[numChanges++][1] = TILE_GRASS;
+            g->score++;
+        }
+    }
+    for (int i = 0; i < SYNTH_NEW_TOMATOES && !newLevel; i++) {
+        int x = rand_r(&g->seed) % GRIDSIZE, y = rand_r(&g->seed) % GRIDSIZE;
+        if (!terrainHasTomato(&g->board, x, y)) {
+            terrainSetTomato(&g->board, x, y);
+            changes[numChanges][0] = y * GRIDSIZE + x;
+            changes[numChanges++][1] = TILE_TOMATO;
+        }
+    }
+
+    g->version++;
+    g->serverMs += tickMs;
+    line += sprintf(line, "d,%d,%d,%d,%d,%d,1,0", g->version, g->serverMs, g->score, terrainCount(&g->board), g->level);
+    for (int i = 0; i < 4; i++)
+        line += sprintf(line, ",%d,%d", g->players[i].x, g->players[i].y);
+    if (newLevel) {
+        line += sprintf(line, ",-1,");
+        terrainPack(&g->board, line);
+        return;
+    }
+    line += sprintf(line, ",%d", numChanges);
+    for (int i = 0; i < numChanges; i++)
+        line += sprintf(line, ",%d,%d", changes[i][0], changes[i][1]);
+}
+
+//the next line of a RECORD_FILE recording that is due by now (ms since the replay started),
+//NULL if none is; the recording starts over from the top when it runs out
+char *recordedUpdate(FILE *f, uint32_t now)
+{
+    static char *buf;
+    static size_t size;
+    static bool have;           // buf holds a line that wasn't due yet
+    static uint32_t at;         // when it is due
+    static bool fromTop = true; // the next line is the first of a pass through the recording
+    static uint32_t first;      // the recording's time of its first line
+    static uint32_t start;      // now when the current pass began
+    uint32_t recorded;
+
+    while (!have) {
+        if (getline(&buf, &size, f) < 0) {
+            //start over, from a clean state
+            rewind(f);
+            memset(&state, 0, sizeof(state));
+            fromTop = true;
+            if (getline(&buf, &size, f) < 0)
+                return NULL;
+        }
+        if (sscanf(buf, "%u ", &recorded) != 1)
+            continue;
+        if (fromTop) {
+            first = recorded;
+            start = now;
+            fromTop = false;
+        }
+        at = start + (recorded - first);
+        buf[strcspn(buf, "\n")] = '\0';
+        have = true;
+    }
+    if (at > now)
+        return NULL;
+    have = false;
+    return buf + strcspn(buf, " ") + 1;
+}
+
+typedef enum
+{
+    PHASE_PARSE,
+    PHASE_PLACE,
+    PHASE_GRID,
+    PHASE_MINIMAP,
+    PHASE_HUD,
+    PHASE_PRESENT,
+    PHASE_FRAME,
+    NUM_PHASES
+} PHASE;
+
+const char *const phaseNames[NUM_PHASES] = {"parse", "place", "grid", "minimap", "hud", "present", "frame"};
+
+int compareMs(const void *a, const void *b)
+{
+    float x = *(const float *) a, y = *(const float *) b;
+    return (x > y) - (x < y);
+}
+
+//average, median, 99th percentile and worst of each phase over the frames
+void printPhaseTimes(float *times[NUM_PHASES], int frames)
+{
+    printf("%-8s %9s %9s %9s %9s\n", "phase", "avg ms", "p50 ms", "p99 ms", "max ms");
+    for (int p = 0; p < NUM_PHASES; p++) {
+        float total = 0;
+        for (int i = 0; i < frames; i++)
+            total += times[p][i];
+        qsort(times[p], frames, sizeof(float), compareMs);
+        printf("%-8s %9.3f %9.3f %9.3f %9.3f\n", phaseNames[p], total / frames,
+               times[p][frames / 2], times[p][(frames * 99) / 100], times[p][frames - 1]);
+    }
+}
+
+//--headless: draw frames into memory as fast as they go, from a recording or synthetic
+//updates arriving at the server's tick rate, then print how long each phase took
+void runHeadless(int frames, const char *recording)
+{
+    FILE *f = NULL;
+    Synthetic *game = NULL;
+    char *line = NULL;
+
+    if (recording != NULL && (f = fopen(recording, "r")) == NULL) {
+        fprintf(stderr, "Could not open %s: %s\n", recording, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (f == NULL) {
+        game = calloc(1, sizeof(Synthetic));
+        line = malloc(TERRAIN_PACKED_SIZE + 256);
+        game->seed = 1;
+        for (int i = 0; i < 4; i++)
+            game->players[i] = (Position) {(i % 2) * (GRIDSIZE - 1), (i / 2) * (GRIDSIZE - 1)};
+    }
+
+    //no display needed: the dummy video driver and a software renderer drawing into memory
+    startSpriteDecode();
+    setenv("SDL_VIDEODRIVER", "dummy", 1);
+    initSDL();
+    SDL_Surface *screen = SDL_CreateRGBSurfaceWithFormat(0, WINDOW_WIDTH, WINDOW_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Renderer *renderer = (screen != NULL) ? SDL_CreateSoftwareRenderer(screen) : NULL;
+    if (renderer == NULL) {
+        fprintf(stderr, "Error creating offscreen renderer: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    loadResources(renderer);
+
+    char *zoomEnv = getenv("ZOOM");
+    if (zoomEnv != NULL && atoi(zoomEnv) >= MIN_TILE_PX && atoi(zoomEnv) <= MAX_TILE_PX)
+        zoomTilePx = atoi(zoomEnv);
+    char *fpsEnv = getenv("FPS");
+    int frameMs = 1000 / ((fpsEnv && atoi(fpsEnv) > 0) ? atoi(fpsEnv) : DEFAULT_FPS);
+    char *delay = getenv("INTERP_DELAY_MS");
+    interpDelayMs = delay ? atoi(delay) : 2 * tickMs;
+    tbuf_init(&published, &snapshots[0], &snapshots[1], &snapshots[2]);
+
+    float *times[NUM_PHASES];
+    for (int p = 0; p < NUM_PHASES; p++)
+        times[p] = malloc(frames * sizeof(float));
+
+    //time as the client sees it, moved on one frame at a time however long drawing takes
+    uint32_t now = 0, nextTick = 0;
+    DrawPos drawn[4];
+    uint64_t began = pacerNow();
+    for (int i = 0; i < frames; i++) {
+        uint64_t t[NUM_PHASES + 1];
+        t[0] = pacerNow();
+
+        char *update;
+        if (game != NULL) {
+            for (; nextTick <= now; nextTick += tickMs) {
+                syntheticUpdate(game, line);
+                applyLine(line, nextTick);
+            }
+        }
+        else {
+            while ((update = recordedUpdate(f, now)) != NULL)
+                applyLine(update, now);
+        }
+        GameState *s = tbuf_front(&published, NULL);
+        t[1] = pacerNow();
+
+        placePlayers(s, drawn, now, frameMs);
+        int me = s->localPlayerId - 1;
+        if (me >= 0 && me < 4 && drawn[me].visible)
+            updateCamera(&camera, drawn[me].x + 0.5f, drawn[me].y + 0.5f);
+        else
+            updateCamera(&camera, GRIDSIZE / 2.0f, GRIDSIZE / 2.0f);
+        t[2] = pacerNow();
 
-    SDL_Rect scoreDest;
-    TTF_SizeText(font, scoreStr, &scoreDest.w, &scoreDest.h);
-    scoreDest.x = 0;
-    scoreDest.y = 0;
+        SDL_SetRenderDrawColor(renderer, 0, 105, 6, 255);
+        SDL_RenderClear(renderer);
+        bool densityChanged = densityUpdate(&density, &s->terrain, &s->terrainLog);
+        minimapStale = minimapStale || densityChanged;
+        drawGrid(renderer, s, drawn, &camera, densityChanged);
+        t[3] = pacerNow();
 
-    SDL_Rect levelDest;
-    TTF_SizeText(font, levelStr, &levelDest.w, &levelDest.h);
-    levelDest.x = GRID_DRAW_WIDTH - levelDest.w;
-    levelDest.y = 0;
+        if (showMinimap && minimap != NULL)
+            drawMinimap(renderer, s, drawn, &camera, now);
+        t[4] = pacerNow();
 
-    SDL_RenderCopy(renderer, scoreTexture, NULL, &scoreDest);
-    SDL_RenderCopy(renderer, levelTexture, NULL, &levelDest);
+        drawUI(renderer, s);
+        t[5] = pacerNow();
 
-    SDL_FreeSurface(scoreSurface);
-    SDL_DestroyTexture(scoreTexture);
+        SDL_RenderPresent(renderer);
+        t[6] = pacerNow();
 
-    SDL_FreeSurface(levelSurface);
-    SDL_DestroyTexture(levelTexture);
+        for (int p = 0; p < PHASE_FRAME; p++)
+            times[p][i] = (t[p + 1] - t[p]) / 1e6f;
+        times[PHASE_FRAME][i] = (t[6] - t[0]) / 1e6f;
+        now += frameMs;
+    }
+    float elapsedMs = (pacerNow() - began) / 1e6f;
+
+    printf("%d frames of %s in %.1f ms (%.1f frames a second unpaced)\n", frames,
+           recording ? recording : "synthetic updates", elapsedMs, frames * 1000 / elapsedMs);
+    printPhaseTimes(times, frames);
+
+    for (int p = 0; p < NUM_PHASES; p++)
+        free(times[p]);
+    free(game);
+    free(line);
+    if (f != NULL)
+        fclose(f);
+    freeResources();
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(screen);
+    TTF_Quit();
+    IMG_Quit();
+    SDL_Quit();
 }
 
 int main(int argc, char* argv[])
 {
 
-    int clientfd;
-    char *host, *port;
-    rio_t rio;
+    if (argc >= 2 && strcmp(argv[1], "--headless") == 0) {
+        long frames = HEADLESS_FRAMES;
+        char *end;
+        if (argc >= 3) {
+            frames = strtol(argv[2], &end, 10);
+            if (end == argv[2] || *end != '\0')
+                frames = 0;
+        }
+        //a positive whole number of frames, anything else gets the usage below
+        if (argc <= 4 && frames > 0 && frames <= INT_MAX) {
+            runHeadless(frames, argc >= 4 ? argv[3] : NULL);
+            exit(0);
+        }
+    }
 
-    if (argc != 3) {
+    if (argc != 3 || strcmp(argv[1], "--headless") == 0) {
 	    fprintf(stderr, "usage: %s <host> <port>\n", argv[0]);
+	    fprintf(stderr, "       %s --headless [frames] [recording]\n", argv[0]);
 	    exit(0);
     }
 
     host = argv[1];
     port = argv[2];
 
+    traceInit("client", requestQuit);
+
+    //a write to a dropped connection must fail so we can reconnect
+    Signal(SIGPIPE, SIG_IGN);
+
+    //the images decode while we connect
+    startSpriteDecode();
+
     //establish connection to server
-    clientfd = Open_clientfd(host, port);
-    Rio_readinitb(&rio, clientfd);
+    if (!connectToServer(false)) {
+        fprintf(stderr, "Could not connect to %s:%s\n", host, port);
+        exit(EXIT_FAILURE);
+    }
     
     
     initSDL();
 
-    font = TTF_OpenFont("resources/Burbank-Big-Condensed-Bold-Font.otf", HEADER_HEIGHT);
-    if (font == NULL) {
-        fprintf(stderr, "Error loading font: %s\n", TTF_GetError());
-        exit(EXIT_FAILURE);
-    }
-
     //puts("start of main");
 
     SDL_Window* window = SDL_CreateWindow("Client", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WINDOW_WIDTH, WINDOW_HEIGHT, 0);
@@ -244,7 +1816,11 @@ int main(int argc, char* argv[])
         exit(EXIT_FAILURE);
     }
 
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, 0);
+    //let consecutive copies from the same texture reach the driver as one batch
+    SDL_SetHint(SDL_HINT_RENDER_BATCHING, "1");
+    char *vsyncEnv = getenv("VSYNC");
+    bool vsync = vsyncEnv == NULL || atoi(vsyncEnv) != 0;
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
 
 	if (renderer == NULL)
 	{
@@ -252,149 +1828,119 @@ int main(int argc, char* argv[])
         exit(EXIT_FAILURE);
 	}
 
-    SDL_Texture *grassTexture = IMG_LoadTexture(renderer, "resources/grass.png");
-    SDL_Texture *tomatoTexture = IMG_LoadTexture(renderer, "resources/tomato.png");
-    SDL_Texture *player1Texture = IMG_LoadTexture(renderer, "resources/player1.png");
-    SDL_Texture *player2Texture = IMG_LoadTexture(renderer, "resources/player2.png");
-    SDL_Texture *player3Texture = IMG_LoadTexture(renderer, "resources/player3.png");
-    SDL_Texture *player4Texture = IMG_LoadTexture(renderer, "resources/player4.png");
-    
-
-    int length;
-    char intToChar[10];
-    int tempcounter = 0;
-
-    // main game loop
+    loadResources(renderer);
+
+    //present() paces the frames when it waits for a refresh that comes no faster than we want
+    SDL_RendererInfo rendererInfo;
+    SDL_DisplayMode mode;
+    char *fpsEnv = getenv("FPS");
+    int targetFps = fpsEnv ? atoi(fpsEnv) : DEFAULT_FPS;
+    int refreshRate = (SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0) ? mode.refresh_rate : DEFAULT_FPS;
+    SDL_GetRendererInfo(renderer, &rendererInfo);
+    pacerInit(&pacer, targetFps, (rendererInfo.flags & SDL_RENDERER_PRESENTVSYNC) && refreshRate <= targetFps);
+    bool frameStats = getenv("FRAME_STATS") != NULL;
+    stateEvent = SDL_RegisterEvents(1);
+
+    char *csvPath = getenv("PERF_CSV");
+    if (csvPath != NULL && (perf.csv = fopen(csvPath, "w")) == NULL)
+        fprintf(stderr, "Could not open %s: %s\n", csvPath, strerror(errno));
+    if (perf.csv != NULL)
+        fprintf(perf.csv, "time_ms,fps,frame_ms,frame_p99_ms,draw_ms,parse_us,rtt_ms,updates_per_s,"
+                          "bytes_in_per_s,bytes_out_per_s,key_to_photon_ms,key_to_photon_max_ms,key_presses\n");
+
+    char *recordPath = getenv("RECORD_FILE");
+    if (recordPath != NULL && (recordFile = fopen(recordPath, "w")) == NULL)
+        fprintf(stderr, "Could not open %s: %s\n", recordPath, strerror(errno));
+
+    char *delay = getenv("INTERP_DELAY_MS");
+    interpDelayMs = delay ? atoi(delay) : 2 * tickMs;
+
+    //the network thread takes over the socket from here
+    spsc_init(&inputs, INPUT_QUEUE_SIZE);
+    spsc_init(&inputTimes, INPUT_QUEUE_SIZE);
+    tbuf_init(&published, &snapshots[0], &snapshots[1], &snapshots[2]);
+    if (pipe(wakeFds) < 0)
+        unix_error("pipe error");
+    pthread_t networkTid;
+    Pthread_create(&networkTid, NULL, networkThread, NULL);
+
+    // main game loop, runs at the target rate whatever the network does, and idles
+    // while there is nothing new to show
+    uint32_t lastFrame = SDL_GetTicks();
+    uint32_t statsAt = lastFrame;
+    DrawPos drawn[4];
+    DrawPos shownDrawn[4] = {0};
+    Camera shownCamera = {0};
     while (!shouldExit) {
-        //puts("in loop");
-        SDL_SetRenderDrawColor(renderer, 0, 105, 6, 255);
-        SDL_RenderClear(renderer);
-
-        //Receiving data from server
-        Rio_readlineb(&rio, buf, MAXLINE);
-        //puts("just read data server");
-
-        //do parsing here and save local changes 
-        length = strlen(buf);
-        char * temp2[300];
-        //char intToChar[10];
-        tempcounter = 0;
-        char *p2;
-        p2 = strtok(buf, ",");
-
-        //storing values from buf into temp2 array
-        for (size_t i = 0; i < length; i++) {
-            if (p2) {
-                temp2[i] = p2;
-            }
-            p2 = strtok(NULL, ",");
-        }
-
-        //saving positions into grid
-        for (int y = 0; y < GRIDSIZE; y++) {
-            for (int x = 0; x < GRIDSIZE; x++) {
-                if (strcmp(temp2[tempcounter],"0") == 0) { //grass
-                    grid[x][y] = TILE_GRASS;
-                }
-                else if (strcmp(temp2[tempcounter],"1") == 0) { //tomato
-                    grid[x][y] = TILE_TOMATO;
-                }
-                else if (strcmp(temp2[tempcounter],"p1") == 0) { //player1
-                    grid[x][y] = TILE_GRASS;
-                    player1.x = x;
-                    player1.y = y;
-                    p1Exist = true;
-                }
-                else if (strcmp(temp2[tempcounter],"p2") == 0) { //player2
-                    grid[x][y] = TILE_GRASS;
-                    player2.x = x;
-                    player2.y = y;
-                    p2Exist = true;
-                }
-                else if (strcmp(temp2[tempcounter],"p3") == 0) { //player3
-                    grid[x][y] = TILE_GRASS;
-                    player3.x = x;
-                    player3.y = y;
-                    p3Exist = true;
-                }
-                else if (strcmp(temp2[tempcounter],"p4") == 0) { //player4
-                    grid[x][y] = TILE_GRASS;
-                    player4.x = x;
-                    player4.y = y;
-                    p4Exist = true;
-                }
-                tempcounter++;
-            }
-        }
-        
-        //storing score, numOfTomatos, level, and playerID
-        score = atoi(temp2[tempcounter]);
-        //printf("score is : %d\n", score);
-        tempcounter++;
-        numTomatoes = atoi(temp2[tempcounter]);
-        //printf("tomatoes is : %d\n", numTomatoes);
-        tempcounter++;
-        level = atoi(temp2[tempcounter]);
-        //printf("level is : %d\n", level);
-        tempcounter++;
-        localPlayerId = atoi(temp2[tempcounter]);
-        //printf("id is : %d\n", localPlayerId);
-        tempcounter = 0;
-        strcpy(buf, "");   
-
-        // if (p2Exist) {
-        //     printf("p2 exist\n");
-        // }
-
-        if (localPlayerId == 1) {
-            currentPlayer = &player1;
-        }
-        else if (localPlayerId == 2) {
-            currentPlayer = &player2;
-        }
-        else if (localPlayerId == 3) {
-            currentPlayer = &player3;
+        uint64_t traceFrame = TRACE_START();
+        pacerFrameStart(&pacer);
+        uint32_t frameStart = SDL_GetTicks();
+        processInputs();
+        bool fresh;
+        GameState *s = tbuf_front(&published, &fresh);
+        placePlayers(s, drawn, frameStart, frameStart - lastFrame);
+        lastFrame = frameStart;
+
+        int me = s->localPlayerId - 1;
+        if (me >= 0 && me < 4 && drawn[me].visible)
+            updateCamera(&camera, drawn[me].x + 0.5f, drawn[me].y + 0.5f);
+        else
+            updateCamera(&camera, GRIDSIZE / 2.0f, GRIDSIZE / 2.0f);
+
+        if (frameStats && frameStart - statsAt >= FRAME_STATS_MS) {
+            printFrameStats();
+            statsAt = frameStart;
         }
-        else if (localPlayerId == 4) {
-            currentPlayer = &player4;
+        samplePerf(frameStart);
+
+        //the same frame again, or one nobody can see: sleep until an input or an update arrives
+        bool minimapDue = showMinimap && minimapStale && frameStart - minimapDrawnAt >= MINIMAP_REFRESH_MS;
+        if (windowHidden || (!redraw && !fresh && !minimapDue && sameView(drawn, shownDrawn, &camera, &shownCamera))) {
+            pacerIdle(&pacer);
+            SDL_WaitEventTimeout(NULL, windowHidden ? HIDDEN_WAIT_MS : IDLE_WAIT_MS);
+            continue;
         }
-        //printf("the id is: %d\n", localPlayerId);
-        processInputs();
-        
-        //encoding into buf
-        sprintf(intToChar, "%d", currentPlayer->x);
-        strcat(buf, intToChar);
-        strcat(buf, ",");
-
-        sprintf(intToChar, "%d", currentPlayer->y);
-        strcat(buf, intToChar);
-        strcat(buf, "\n");
-
-        //writing to server
-        Rio_writen(clientfd, buf, strlen(buf));
-        strcpy(buf, "");
-
-        drawGrid(renderer, grassTexture, tomatoTexture, player1Texture, player2Texture, player3Texture, player4Texture);
-        drawUI(renderer);
-        // p1Exist = false;
-        // p2Exist = false;
-        // p3Exist = false;
-        // p4Exist = false;
+        redraw = false;
+        memcpy(shownDrawn, drawn, sizeof(drawn));
+        shownCamera = camera;
 
+        uint64_t traceStep = TRACE_START();
+        SDL_SetRenderDrawColor(renderer, 0, 105, 6, 255);
+        SDL_RenderClear(renderer);
+        bool densityChanged = densityUpdate(&density, &s->terrain, &s->terrainLog);
+        minimapStale = minimapStale || densityChanged;
+        drawGrid(renderer, s, drawn, &camera, densityChanged);
+        if (showMinimap && minimap != NULL)
+            drawMinimap(renderer, s, drawn, &camera, frameStart);
+        drawUI(renderer, s);
+        if (perf.shown)
+            drawPerf(renderer);
+        TRACE_END("render", traceStep);
+
+        traceStep = TRACE_START();
         SDL_RenderPresent(renderer);
-
-        SDL_Delay(16); // 16 ms delay to limit display to 60 fps
+        TRACE_END("present", traceStep);
+        pacerFrameShown(&pacer);
+        notePresented(s, SDL_GetTicks());
+        TRACE_END("frame", traceFrame);
+
+        traceStep = TRACE_START();
+        pacerWait(&pacer);
+        TRACE_END("pace", traceStep);
     }
 
-    // clean up everything
-    SDL_DestroyTexture(grassTexture);
-    SDL_DestroyTexture(tomatoTexture);
-    SDL_DestroyTexture(player1Texture);
-    SDL_DestroyTexture(player2Texture);
-    SDL_DestroyTexture(player3Texture);
-    SDL_DestroyTexture(player4Texture);
+    //unblock the network thread wherever it is waiting and let it finish
+    char wake = 1;
+    write(wakeFds[1], &wake, 1);
+    shutdown(clientfd, SHUT_RDWR);
+    Pthread_join(networkTid, NULL);
 
-    TTF_CloseFont(font);
+    // clean up everything
+    freeResources();
+    if (recordFile != NULL)
+        fclose(recordFile);
+    if (perf.csv != NULL)
+        fclose(perf.csv);
     TTF_Quit();
 
     IMG_Quit();
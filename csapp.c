@@ -1,6 +1,14 @@
 /* 
  * csapp.c - Functions for the CS:APP3e book
  *
+ * Updated 10/2026:
+ *   - Added rio_readlinev and rio_readframev, which return views into
+ *     the internal buffer instead of copying
+ *   - Added the buffered writer (rio_wt): rio_writeb, rio_writevb and
+ *     rio_flushb coalesce small writes into one writev() per flush
+ *   - rio_readlineb: copy whole spans found with memchr instead of
+ *     one byte per rio_read call
+ *
  * Updated 10/2016 reb:
  *   - Fixed bug in sio_ltoa that didn't cover negative numbers
  *
@@ -793,6 +801,28 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 /* $end rio_writen */
 
 
+/*
+ * rio_fill - Refill the internal buffer via read() if it is empty.
+ *    Returns the number of unread bytes, 0 on EOF and -1 on error.
+ */
+/* $begin rio_fill */
+static ssize_t rio_fill(rio_t *rp)
+{
+    while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
+	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, RIO_BUFSIZE);
+	if (rp->rio_cnt < 0) {
+	    if (errno != EINTR) /* Interrupted by sig handler return */
+		return -1;
+	}
+	else if (rp->rio_cnt == 0)  /* EOF */
+	    return 0;
+	else 
+	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
+    }
+    return rp->rio_cnt;
+}
+/* $end rio_fill */
+
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
  *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
@@ -805,19 +835,10 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 {
     int cnt;
+    ssize_t rc;
 
-    while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
-	if (rp->rio_cnt < 0) {
-	    if (errno != EINTR) /* Interrupted by sig handler return */
-		return -1;
-	}
-	else if (rp->rio_cnt == 0)  /* EOF */
-	    return 0;
-	else 
-	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
-    }
+    if ((rc = rio_fill(rp)) <= 0)
+	return rc;
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
     cnt = n;          
@@ -866,33 +887,288 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 
 /* 
  * rio_readlineb - Robustly read a text line (buffered)
+ *    Scans the internal buffer for the newline with memchr() and copies
+ *    whole spans at a time; a line that straddles a refill is assembled
+ *    from one span per refill.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
-	} else
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *nl = NULL, *bufp = usrbuf;
+
+    while (nl == NULL && n + 1 < maxlen) {
+	if ((rc = rio_fill(rp)) < 0)
 	    return -1;	  /* Error */
+	else if (rc == 0)
+	    break;        /* EOF */
+
+	/* Copy up to and including the newline, bounded by maxlen-1 */
+	cnt = rp->rio_cnt;
+	if (cnt > maxlen - 1 - n)
+	    cnt = maxlen - 1 - n;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1;
+	memcpy(bufp, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	bufp += cnt;
+	n += cnt;
     }
-    *bufp = 0;
-    return n-1;
+    if (maxlen > 0)
+	*bufp = 0;
+    return n;
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_fillv - Make sure at least need unread bytes sit contiguously in
+ *    the internal buffer, moving the unread bytes to the front of the
+ *    buffer when the tail is too short. Returns the number of unread
+ *    bytes (fewer than need only on EOF or when need > RIO_BUFSIZE)
+ *    and -1 on error.
+ */
+/* $begin rio_fillv */
+static ssize_t rio_fillv(rio_t *rp, size_t need)
+{
+    ssize_t rc;
+
+    if (rp->rio_cnt <= 0)
+	rp->rio_bufptr = rp->rio_buf;
+    if (need > RIO_BUFSIZE)
+	need = RIO_BUFSIZE;
+
+    while (rp->rio_cnt < need) {
+	/* Compact if the unread bytes can't grow in place */
+	if (rp->rio_bufptr + need > rp->rio_buf + RIO_BUFSIZE) {
+	    memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	    rp->rio_bufptr = rp->rio_buf;
+	}
+	char *end = rp->rio_bufptr + rp->rio_cnt;
+	if ((rc = read(rp->rio_fd, end, rp->rio_buf + RIO_BUFSIZE - end)) < 0) {
+	    if (errno != EINTR) /* Interrupted by sig handler return */
+		return -1;
+	}
+	else if (rc == 0)  /* EOF */
+	    break;
+	else
+	    rp->rio_cnt += rc;
+    }
+    return rp->rio_cnt;
+}
+/* $end rio_fillv */
+
+/*
+ * rio_readlinev - Read a text line without copying it. On return *linep
+ *    points into the internal buffer and stays valid until the next read
+ *    from rp. The newline is overwritten with a NUL so the line can be
+ *    used as a C string. Like rio_readlineb, returns the number of bytes
+ *    consumed including the newline, 0 on EOF and -1 on error. A line
+ *    longer than RIO_BUFSIZE is returned in RIO_BUFSIZE pieces.
+ */
+/* $begin rio_readlinev */
+ssize_t rio_readlinev(rio_t *rp, char **linep)
+{
+    size_t scanned = 0;
+    ssize_t rc;
+    char *nl;
+
+    for (;;) {
+	if ((nl = memchr(rp->rio_bufptr + scanned, '\n', rp->rio_cnt - scanned)) != NULL)
+	    break;
+	scanned = rp->rio_cnt;
+	if (scanned == RIO_BUFSIZE) {
+	    nl = rp->rio_bufptr + scanned;  /* Full buffer, no newline */
+	    break;
+	}
+	if ((rc = rio_fillv(rp, scanned + 1)) < 0)
+	    return -1;
+	if (rc == scanned) {  /* EOF */
+	    if (scanned == 0)
+		return 0;
+	    nl = rp->rio_bufptr + scanned;
+	    break;
+	}
+    }
+
+    /* nl never passes rio_buf[RIO_BUFSIZE], the spare byte in rio_t */
+    size_t used = nl - rp->rio_bufptr;
+    if (used < rp->rio_cnt)
+	used++;  /* Consume the newline too */
+    *nl = 0;
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += used;
+    rp->rio_cnt -= used;
+    return used;
+}
+/* $end rio_readlinev */
+
+/*
+ * rio_readframev - Read a length-prefixed frame without copying it. A
+ *    frame is a 4-byte length in network byte order followed by that
+ *    many payload bytes; *framep points at the payload, valid until the
+ *    next read from rp. Returns the payload length, 0 on EOF before a
+ *    header and -1 on error, a truncated frame (EPIPE) or a frame that
+ *    can't fit in the buffer (EMSGSIZE).
+ */
+/* $begin rio_readframev */
+ssize_t rio_readframev(rio_t *rp, char **framep)
+{
+    uint32_t netlen;
+    size_t len;
+    ssize_t rc;
+
+    if ((rc = rio_fillv(rp, sizeof(netlen))) < 0)
+	return -1;
+    if (rc == 0)
+	return 0;
+    if (rc < sizeof(netlen)) {
+	errno = EPIPE;
+	return -1;
+    }
+    memcpy(&netlen, rp->rio_bufptr, sizeof(netlen));
+    len = ntohl(netlen);
+    if (len > RIO_BUFSIZE - sizeof(netlen)) {
+	errno = EMSGSIZE;
+	return -1;
+    }
+
+    if ((rc = rio_fillv(rp, sizeof(netlen) + len)) < 0)
+	return -1;
+    if (rc < sizeof(netlen) + len) {
+	errno = EPIPE;
+	return -1;
+    }
+    *framep = rp->rio_bufptr + sizeof(netlen);
+    rp->rio_bufptr += sizeof(netlen) + len;
+    rp->rio_cnt -= sizeof(netlen) + len;
+    return len;
+}
+/* $end rio_readframev */
+
+/*
+ * rio_writeinitb - Associate a descriptor with a buffered writer
+ */
+/* $begin rio_writeinitb */
+void rio_writeinitb(rio_wt *wp, int fd)
+{
+    wp->rio_fd = fd;
+    wp->rio_cnt = 0;
+    wp->rio_pending = 0;
+    wp->rio_iovcnt = 0;
+}
+/* $end rio_writeinitb */
+
+/*
+ * rio_flushb - Write everything queued on wp with as few writev() calls
+ *    as possible (one unless the kernel takes a partial write).
+ *    Returns 0 on success, -1 on error.
+ */
+/* $begin rio_flushb */
+ssize_t rio_flushb(rio_wt *wp)
+{
+    struct iovec *iov = wp->rio_iov;
+    int iovcnt = wp->rio_iovcnt;
+    ssize_t nwritten;
+
+    while (iovcnt > 0) {
+	if ((nwritten = writev(wp->rio_fd, iov, iovcnt)) < 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		continue;        /* and call writev() again */
+	    return -1;           /* errno set by writev() */
+	}
+	if (nwritten == 0) {     /* Nothing taken, errno is stale */
+	    errno = EIO;
+	    return -1;
+	}
+	/* Skip the entries that went out, trim a partially written one */
+	while (iovcnt > 0 && nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    wp->rio_cnt = 0;
+    wp->rio_pending = 0;
+    wp->rio_iovcnt = 0;
+    return 0;
+}
+/* $end rio_flushb */
+
+/*
+ * rio_writevb - Queue iovcnt caller-owned buffers on wp without copying
+ *    them. They must stay unchanged until the next flush. Flushes first
+ *    if the iovec table is full and afterwards once RIO_BUFSIZE bytes
+ *    are pending. Returns 0 on success, -1 on error.
+ */
+/* $begin rio_writevb */
+ssize_t rio_writevb(rio_wt *wp, const struct iovec *iov, int iovcnt)
+{
+    for (int i = 0; i < iovcnt; i++) {
+	if (iov[i].iov_len == 0)
+	    continue;
+	if (wp->rio_iovcnt == RIO_IOVMAX && rio_flushb(wp) < 0)
+	    return -1;
+	wp->rio_iov[wp->rio_iovcnt++] = iov[i];
+	wp->rio_pending += iov[i].iov_len;
+    }
+    if (wp->rio_pending >= RIO_BUFSIZE)
+	return rio_flushb(wp);
+    return 0;
+}
+/* $end rio_writevb */
+
+/*
+ * rio_writeb - Copy n bytes into wp's internal buffer to go out with the
+ *    next flush. Adjacent copies share one iovec entry. Writes larger
+ *    than the buffer are flushed along with everything queued before
+ *    them. When the buffer or the iovec table is full it is flushed before
+ *    the copy, since a flush starts the buffer over. Returns n on
+ *    success, -1 on error.
+ */
+/* $begin rio_writeb */
+ssize_t rio_writeb(rio_wt *wp, void *usrbuf, size_t n)
+{
+    struct iovec iov;
+
+    if (n > RIO_BUFSIZE) {
+	iov.iov_base = usrbuf;
+	iov.iov_len = n;
+	if (rio_writevb(wp, &iov, 1) < 0 || rio_flushb(wp) < 0)
+	    return -1;
+	return n;
+    }
+
+    if ((wp->rio_cnt + n > RIO_BUFSIZE || wp->rio_iovcnt == RIO_IOVMAX) && rio_flushb(wp) < 0)
+	return -1;
+
+    char *bufp = wp->rio_buf + wp->rio_cnt;
+    memcpy(bufp, usrbuf, n);
+    wp->rio_cnt += n;
+
+    /* Extend the previous entry if it ends where this copy starts */
+    struct iovec *last = wp->rio_iovcnt ? &wp->rio_iov[wp->rio_iovcnt - 1] : NULL;
+    if (last != NULL && (char *)last->iov_base + last->iov_len == bufp) {
+	last->iov_len += n;
+	wp->rio_pending += n;
+	if (wp->rio_pending >= RIO_BUFSIZE && rio_flushb(wp) < 0)
+	    return -1;
+	return n;
+    }
+
+    iov.iov_base = bufp;
+    iov.iov_len = n;
+    if (rio_writevb(wp, &iov, 1) < 0)
+	return -1;
+    return n;
+}
+/* $end rio_writeb */
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -934,6 +1210,47 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return rc;
 } 
 
+ssize_t Rio_readlinev(rio_t *rp, char **linep)
+{
+    ssize_t rc;
+
+    if ((rc = rio_readlinev(rp, linep)) < 0)
+	unix_error("Rio_readlinev error");
+    return rc;
+}
+
+ssize_t Rio_readframev(rio_t *rp, char **framep)
+{
+    ssize_t rc;
+
+    if ((rc = rio_readframev(rp, framep)) < 0)
+	unix_error("Rio_readframev error");
+    return rc;
+}
+
+void Rio_writeinitb(rio_wt *wp, int fd)
+{
+    rio_writeinitb(wp, fd);
+}
+
+void Rio_writeb(rio_wt *wp, void *usrbuf, size_t n)
+{
+    if (rio_writeb(wp, usrbuf, n) != n)
+	unix_error("Rio_writeb error");
+}
+
+void Rio_writevb(rio_wt *wp, const struct iovec *iov, int iovcnt)
+{
+    if (rio_writevb(wp, iov, iovcnt) < 0)
+	unix_error("Rio_writevb error");
+}
+
+void Rio_flushb(rio_wt *wp)
+{
+    if (rio_flushb(wp) < 0)
+	unix_error("Rio_flushb error");
+}
+
 /******************************** 
  * Client/server helper functions
  ********************************/
@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <math.h>
 #include <pthread.h>
@@ -47,10 +48,23 @@ typedef struct {
     int rio_fd;                /* Descriptor for this internal buf */
     int rio_cnt;               /* Unread bytes in internal buf */
     char *rio_bufptr;          /* Next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+    char rio_buf[RIO_BUFSIZE + 1]; /* Internal buffer (+1 for rio_readlinev's NUL) */
 } rio_t;
 /* $end rio_t */
 
+/* Persistent state for the buffered Rio writer */
+/* $begin rio_wt */
+#define RIO_IOVMAX 64
+typedef struct {
+    int rio_fd;                /* Descriptor for this writer */
+    size_t rio_cnt;            /* Bytes used in internal buf */
+    size_t rio_pending;        /* Bytes queued for the next flush */
+    int rio_iovcnt;            /* Entries used in rio_iov */
+    struct iovec rio_iov[RIO_IOVMAX]; /* Gather list for writev() */
+    char rio_buf[RIO_BUFSIZE]; /* Internal buffer for copied writes */
+} rio_wt;
+/* $end rio_wt */
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
@@ -178,6 +192,12 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t	rio_readlinev(rio_t *rp, char **linep);
+ssize_t	rio_readframev(rio_t *rp, char **framep);
+void rio_writeinitb(rio_wt *wp, int fd);
+ssize_t	rio_writeb(rio_wt *wp, void *usrbuf, size_t n);
+ssize_t	rio_writevb(rio_wt *wp, const struct iovec *iov, int iovcnt);
+ssize_t	rio_flushb(rio_wt *wp);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
@@ -185,6 +205,12 @@ void Rio_writen(int fd, void *usrbuf, size_t n);
 void Rio_readinitb(rio_t *rp, int fd); 
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t Rio_readlinev(rio_t *rp, char **linep);
+ssize_t Rio_readframev(rio_t *rp, char **framep);
+void Rio_writeinitb(rio_wt *wp, int fd);
+void Rio_writeb(rio_wt *wp, void *usrbuf, size_t n);
+void Rio_writevb(rio_wt *wp, const struct iovec *iov, int iovcnt);
+void Rio_flushb(rio_wt *wp);
 
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
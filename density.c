@@ -0,0 +1,53 @@
+/*
+ * density.c - tomato counts per block of the board (see density.h)
+ */
+#include <string.h>
+
+#include "density.h"
+
+//counts for an empty board, not yet tied to any log
+void densityInit(Density *d)
+{
+    memset(d, 0, sizeof(*d));
+}
+
+//count every tile and block of t from scratch
+static void densityRecount(Density *d, const Terrain *t)
+{
+    for (size_t w = 0; w < TERRAIN_WORDS; w++)
+        d->tiles[w] = __builtin_popcountll(t->words[w]);
+
+    int blockCells = DENSITY_BLOCK_TILES * 8;
+    for (int by = 0; by < DENSITY_BLOCKS_PER_ROW; by++) {
+        for (int bx = 0; bx < DENSITY_BLOCKS_PER_ROW; bx++) {
+            d->blocks[(uint64_t) by * DENSITY_BLOCKS_PER_ROW + bx] =
+                terrainCountRect(t, bx * blockCells, by * blockCells, (bx + 1) * blockCells, (by + 1) * blockCells);
+        }
+    }
+}
+
+//bring the counts up to date with t, whose changes since the last update are in log;
+//returns whether any tile changed (even if its count did not)
+bool densityUpdate(Density *d, const Terrain *t, const DensityLog *log)
+{
+    if (d->valid && d->replaced == log->replaced && d->logged == log->logged)
+        return false;
+
+    if (!d->valid || d->replaced != log->replaced || log->logged - d->logged > DENSITY_LOG_SIZE) {
+        densityRecount(d, t);
+    } else {
+        for (uint32_t i = d->logged; i != log->logged; i++) {
+            uint32_t w = log->words[i % DENSITY_LOG_SIZE];
+            int count = __builtin_popcountll(t->words[w]);
+            int tileX = w % TERRAIN_TILES_PER_ROW, tileY = w / TERRAIN_TILES_PER_ROW;
+            uint64_t block = (uint64_t) (tileY / DENSITY_BLOCK_TILES) * DENSITY_BLOCKS_PER_ROW + tileX / DENSITY_BLOCK_TILES;
+
+            d->blocks[block] += count - d->tiles[w];
+            d->tiles[w] = count;
+        }
+    }
+    d->valid = true;
+    d->replaced = log->replaced;
+    d->logged = log->logged;
+    return true;
+}
@@ -0,0 +1,74 @@
+/*
+ * density.h - tomato counts per block of the board, for drawing it zoomed out
+ *
+ * Two levels: every 8x8 tile (one terrain word, so its count is a popcount)
+ * and every 64x64 block (8x8 tiles). Whoever writes the terrain notes the
+ * words it changed in a DensityLog; densityUpdate() recounts only those
+ * tiles and adjusts their block by the difference, so a frame where nothing
+ * changed costs nothing. Replacing the whole board (a new level, a full
+ * state) is noted instead, and that is the only time every block is counted.
+ */
+#ifndef __DENSITY_H__
+#define __DENSITY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "terrain.h"
+
+// A block is DENSITY_BLOCK_TILES x DENSITY_BLOCK_TILES tiles
+#define DENSITY_BLOCK_TILES 8
+#define DENSITY_BLOCKS_PER_ROW ((TERRAIN_TILES_PER_ROW + DENSITY_BLOCK_TILES - 1) / DENSITY_BLOCK_TILES)
+#define DENSITY_BLOCKS ((uint64_t) DENSITY_BLOCKS_PER_ROW * DENSITY_BLOCKS_PER_ROW)
+
+// Most tomatoes a tile or a block can hold
+#define DENSITY_TILE_MAX 64
+#define DENSITY_BLOCK_MAX (64 * DENSITY_BLOCK_TILES * DENSITY_BLOCK_TILES)
+
+// Changed words the log remembers, more between two updates means a recount
+#define DENSITY_LOG_SIZE 256
+
+typedef struct
+{
+    uint32_t replaced;                // bumped whenever the whole terrain is replaced
+    uint32_t logged;                  // words ever logged, the newest at (logged - 1) % DENSITY_LOG_SIZE
+    uint32_t words[DENSITY_LOG_SIZE]; // indices into Terrain.words
+} DensityLog;
+
+typedef struct
+{
+    bool valid;                       // false until the first update
+    uint32_t replaced;                // the log's replaced and logged the counts are for
+    uint32_t logged;
+    uint8_t tiles[TERRAIN_WORDS];     // tomatoes per tile, indexed like Terrain.words
+    uint16_t blocks[DENSITY_BLOCKS];  // tomatoes per block, row by row
+} Density;
+
+//tomatoes in tile (tileX, tileY)
+static inline int densityTile(const Density *d, int tileX, int tileY)
+{
+    return d->tiles[(uint64_t) tileY * TERRAIN_TILES_PER_ROW + tileX];
+}
+
+//tomatoes in block (blockX, blockY)
+static inline int densityBlock(const Density *d, int blockX, int blockY)
+{
+    return d->blocks[(uint64_t) blockY * DENSITY_BLOCKS_PER_ROW + blockX];
+}
+
+//note that the word holding cell (x, y) may have changed
+static inline void densityLogCell(DensityLog *log, int x, int y)
+{
+    log->words[log->logged++ % DENSITY_LOG_SIZE] = terrainBit(x, y) / 64;
+}
+
+//note that the whole terrain was replaced
+static inline void densityLogReplaced(DensityLog *log)
+{
+    log->replaced++;
+}
+
+void densityInit(Density *d);
+bool densityUpdate(Density *d, const Terrain *t, const DensityLog *log);
+
+#endif /* __DENSITY_H__ */
@@ -0,0 +1,99 @@
+/*
+ * glyphs.c - HUD text drawn from a glyph atlas (see glyphs.h)
+ */
+#include <string.h>
+
+#include "glyphs.h"
+
+//render every printable character once and pack them into one texture, false on failure
+bool glyphAtlasInit(GlyphAtlas *atlas, SDL_Renderer *renderer, TTF_Font *font, SDL_Color color)
+{
+    SDL_Surface *rendered[GLYPH_COUNT];
+    int x = 0, y = 0, rowHeight = 0;
+    bool ok = true;
+
+    memset(atlas, 0, sizeof(*atlas));
+    atlas->height = TTF_FontHeight(font);
+
+    //lay the glyphs out in rows first to know how big the atlas has to be
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+        char text[2] = {GLYPH_FIRST + i, '\0'};
+        int minx, maxx, miny, maxy;
+
+        rendered[i] = TTF_RenderText_Solid(font, text, color);
+        if (rendered[i] == NULL || TTF_GlyphMetrics(font, GLYPH_FIRST + i, &minx, &maxx, &miny, &maxy, &atlas->advance[i]) < 0) {
+            ok = false;
+            continue;
+        }
+        if (x + rendered[i]->w > GLYPH_ATLAS_WIDTH) {
+            x = 0;
+            y += rowHeight;
+            rowHeight = 0;
+        }
+        atlas->glyphs[i] = (SDL_Rect) {x, y, rendered[i]->w, rendered[i]->h};
+        x += rendered[i]->w;
+        if (rendered[i]->h > rowHeight)
+            rowHeight = rendered[i]->h;
+    }
+
+    SDL_Surface *sheet = NULL;
+    if (ok)
+        sheet = SDL_CreateRGBSurfaceWithFormat(0, GLYPH_ATLAS_WIDTH, y + rowHeight, 32, SDL_PIXELFORMAT_RGBA32);
+    if (sheet != NULL) {
+        //starts fully transparent, the glyphs' colour key keeps their background that way
+        for (int i = 0; i < GLYPH_COUNT; i++) {
+            SDL_Rect dest = atlas->glyphs[i]; // the blit writes the clipped rect back
+            SDL_BlitSurface(rendered[i], NULL, sheet, &dest);
+        }
+        atlas->texture = SDL_CreateTextureFromSurface(renderer, sheet);
+        SDL_FreeSurface(sheet);
+    }
+
+    for (int i = 0; i < GLYPH_COUNT; i++)
+        SDL_FreeSurface(rendered[i]);
+    return atlas->texture != NULL;
+}
+
+void glyphAtlasFree(GlyphAtlas *atlas)
+{
+    if (atlas->texture != NULL)
+        SDL_DestroyTexture(atlas->texture);
+    atlas->texture = NULL;
+}
+
+//lay out text unless the layout already holds it; characters outside the atlas are skipped
+void textLayoutSet(TextLayout *layout, const GlyphAtlas *atlas, const char *text)
+{
+    if (layout->count > 0 && strncmp(layout->text, text, TEXT_LAYOUT_MAX) == 0)
+        return;
+
+    int pen = 0;
+    layout->count = 0;
+    layout->width = 0;
+    layout->height = atlas->height;
+    strncpy(layout->text, text, TEXT_LAYOUT_MAX);
+    layout->text[TEXT_LAYOUT_MAX] = '\0';
+
+    for (const char *c = layout->text; *c != '\0'; c++) {
+        if (*c < GLYPH_FIRST || *c > GLYPH_LAST)
+            continue;
+        const SDL_Rect *glyph = &atlas->glyphs[*c - GLYPH_FIRST];
+        layout->src[layout->count] = *glyph;
+        layout->dst[layout->count] = (SDL_Rect) {pen, 0, glyph->w, glyph->h};
+        layout->count++;
+        if (pen + glyph->w > layout->width)
+            layout->width = pen + glyph->w;
+        pen += atlas->advance[*c - GLYPH_FIRST];
+    }
+}
+
+//draw a laid out string with its top left corner at (x, y)
+void textLayoutDraw(SDL_Renderer *renderer, const GlyphAtlas *atlas, const TextLayout *layout, int x, int y)
+{
+    for (int i = 0; i < layout->count; i++) {
+        SDL_Rect dest = layout->dst[i];
+        dest.x += x;
+        dest.y += y;
+        SDL_RenderCopy(renderer, atlas->texture, &layout->src[i], &dest);
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * glyphs.h - HUD text drawn from a glyph atlas
+ *
+ * The printable ASCII characters are rendered once with SDL_ttf into a single
+ * texture. A TextLayout holds the source and destination rectangles of one
+ * string and is only rebuilt when the string changes, so drawing text costs a
+ * few copies from one texture and no surface or texture allocation.
+ */
+#ifndef __GLYPHS_H__
+#define __GLYPHS_H__
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#define GLYPH_FIRST ' '
+#define GLYPH_LAST '~'
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+// glyphs are packed in rows at most this wide
+#define GLYPH_ATLAS_WIDTH 1024
+// longest string a TextLayout holds, longer ones are cut
+#define TEXT_LAYOUT_MAX 32
+
+typedef struct
+{
+    SDL_Texture *texture;
+    SDL_Rect glyphs[GLYPH_COUNT]; // where each character is in the texture
+    int advance[GLYPH_COUNT];     // how far the pen moves after it
+    int height;
+} GlyphAtlas;
+
+typedef struct
+{
+    char text[TEXT_LAYOUT_MAX + 1];
+    int count;
+    SDL_Rect src[TEXT_LAYOUT_MAX];
+    SDL_Rect dst[TEXT_LAYOUT_MAX]; // relative to the point the text is drawn at
+    int width;
+    int height;
+} TextLayout;
+
+bool glyphAtlasInit(GlyphAtlas *atlas, SDL_Renderer *renderer, TTF_Font *font, SDL_Color color);
+void glyphAtlasFree(GlyphAtlas *atlas);
+void textLayoutSet(TextLayout *layout, const GlyphAtlas *atlas, const char *text);
+void textLayoutDraw(SDL_Renderer *renderer, const GlyphAtlas *atlas, const TextLayout *layout, int x, int y);
+
+#endif /* __GLYPHS_H__ */
@@ -0,0 +1,41 @@
+/*
+ * mkassets.c - writes assets_data.c (see assets.h) to stdout, embedding
+ *              every file named on the command line
+ *
+ * usage: mkassets <file>... > assets_data.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char *argv[])
+{
+    printf("/* generated by mkassets, do not edit */\n");
+    printf("#include \"assets.h\"\n\n");
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            perror(argv[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        int c;
+        long size = 0;
+        printf("static const unsigned char asset%d[] = {", i);
+        while ((c = fgetc(f)) != EOF) {
+            printf("%s0x%02x,", (size % 16 == 0) ? "\n    " : "", c);
+            size++;
+        }
+        printf("\n};\n\n");
+        fclose(f);
+    }
+
+    printf("const Asset assets[] = {\n");
+    for (int i = 1; i < argc; i++) {
+        const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+        printf("    {\"%s\", asset%d, sizeof(asset%d)},\n", name, i, i);
+    }
+    printf("};\n\nconst int numAssets = %d;\n", argc - 1);
+    return 0;
+}
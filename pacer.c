@@ -0,0 +1,114 @@
+/*
+ * pacer.c - frame pacing and frame-time statistics (see pacer.h)
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pacer.h"
+
+uint64_t pacerNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//targetFps frames a second, or as fast as present() lets us when presentPaces
+void pacerInit(Pacer *p, int targetFps, bool presentPaces)
+{
+    memset(p, 0, sizeof(*p));
+    p->periodNs = (presentPaces || targetFps <= 0) ? 0 : 1000000000ull / targetFps;
+    p->deadlineNs = pacerNow();
+}
+
+void pacerFrameStart(Pacer *p)
+{
+    p->frameStartNs = pacerNow();
+}
+
+//record a frame that was just presented
+void pacerFrameShown(Pacer *p)
+{
+    uint64_t now = pacerNow();
+
+    p->work[p->next] = (now - p->frameStartNs) / 1e6f;
+    p->intervals[p->next] = p->lastPresentNs ? (now - p->lastPresentNs) / 1e6f : p->work[p->next];
+    p->next = (p->next + 1) % PACER_SAMPLES;
+    if (p->samples < PACER_SAMPLES)
+        p->samples++;
+    p->frames++;
+    p->lastPresentNs = now;
+}
+
+//nothing was drawn this time round: the next frame starts a fresh interval and its own deadline
+void pacerIdle(Pacer *p)
+{
+    p->lastPresentNs = 0;
+    p->deadlineNs = pacerNow();
+}
+
+//sleep until the next frame is due
+void pacerWait(Pacer *p)
+{
+    if (p->periodNs == 0)
+        return;
+
+    uint64_t now = pacerNow();
+    p->deadlineNs += p->periodNs;
+    //more than a frame behind: start counting again from now instead of rushing
+    if (p->deadlineNs + p->periodNs < now)
+        p->deadlineNs = now;
+    if (p->deadlineNs <= now)
+        return;
+
+    struct timespec until = {p->deadlineNs / 1000000000ull, p->deadlineNs % 1000000000ull};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+        ;
+}
+
+static int compareFloats(const void *a, const void *b)
+{
+    float x = *(const float *) a, y = *(const float *) b;
+    return (x > y) - (x < y);
+}
+
+//figures over the last PACER_SAMPLES frames
+void pacerStats(const Pacer *p, PacerStats *out)
+{
+    float sorted[PACER_SAMPLES];
+    float total = 0, totalWork = 0;
+
+    memset(out, 0, sizeof(*out));
+    if (p->samples == 0)
+        return;
+
+    for (int i = 0; i < p->samples; i++) {
+        total += p->intervals[i];
+        totalWork += p->work[i];
+    }
+    out->frames = p->samples;
+    out->avgMs = total / p->samples;
+    out->avgWorkMs = totalWork / p->samples;
+
+    float budget = 1.5f * (p->periodNs ? p->periodNs / 1e6f : out->avgMs);
+    for (int i = 0; i < p->samples; i++) {
+        if (p->intervals[i] > budget)
+            out->late++;
+    }
+
+    memcpy(sorted, p->intervals, p->samples * sizeof(float));
+    qsort(sorted, p->samples, sizeof(float), compareFloats);
+    out->p99Ms = sorted[(p->samples * 99) / 100];
+    out->maxMs = sorted[p->samples - 1];
+}
+
+//interval in ms of the frame age frames back (0 the newest), 0 if that is no longer kept
+float pacerInterval(const Pacer *p, int age)
+{
+    if (age < 0 || age >= p->samples)
+        return 0;
+    return p->intervals[(p->next - 1 - age + PACER_SAMPLES) % PACER_SAMPLES];
+}
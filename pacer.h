@@ -0,0 +1,55 @@
+/*
+ * pacer.h - frame pacing and frame-time statistics for the render loop
+ *
+ * With a vsynced renderer whose display refreshes no faster than the
+ * target rate, SDL_RenderPresent() already waits for the next refresh and
+ * the pacer only measures. Otherwise pacerWait() sleeps until the next
+ * frame is due on an absolute CLOCK_MONOTONIC deadline, so the time a frame
+ * took comes off its sleep instead of adding to it and the rate doesn't
+ * drift. A frame that runs late moves the deadline on rather than rushing
+ * the following ones to catch up.
+ */
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// frames kept for the statistics, older ones are overwritten
+#define PACER_SAMPLES 256
+
+typedef struct
+{
+    uint64_t periodNs;       // time between frames, 0 when present() paces them
+    uint64_t deadlineNs;     // when the next frame is due
+    uint64_t frameStartNs;   // when the current frame started
+    uint64_t lastPresentNs;  // when the previous frame was shown, 0 after an idle stretch
+
+    // last PACER_SAMPLES frames, in ms
+    float intervals[PACER_SAMPLES]; // from one frame shown to the next
+    float work[PACER_SAMPLES];      // spent drawing, without the waits
+    int samples;                    // filled entries, at most PACER_SAMPLES
+    int next;                       // entry the next frame goes in
+    uint64_t frames;                // frames shown in all
+} Pacer;
+
+typedef struct
+{
+    int frames;        // frames the figures are over
+    float avgMs;       // interval between frames
+    float p99Ms;
+    float maxMs;
+    float avgWorkMs;   // time spent drawing a frame
+    int late;          // intervals over 1.5 periods (or 1.5 times the average when vsync paces)
+} PacerStats;
+
+uint64_t pacerNow(void);
+void pacerInit(Pacer *p, int targetFps, bool presentPaces);
+void pacerFrameStart(Pacer *p);
+void pacerFrameShown(Pacer *p);
+void pacerIdle(Pacer *p);
+void pacerWait(Pacer *p);
+void pacerStats(const Pacer *p, PacerStats *out);
+float pacerInterval(const Pacer *p, int age);
+
+#endif /* __PACER_H__ */
@@ -0,0 +1,92 @@
+/*
+ * sbuf.c - bounded FIFO of connected descriptors (after the CS:APP3e
+ *          sbuf package), built on the csapp semaphore wrappers
+ */
+/* $begin sbufc */
+#include "sbuf.h"
+
+/* Create an empty, bounded, shared FIFO buffer with n slots */
+/* $begin sbuf_init */
+void sbuf_init(sbuf_t *sp, int n)
+{
+    sp->buf = Calloc(n, sizeof(int));
+    sp->n = n;                       /* Buffer holds max of n items */
+    sp->front = sp->rear = 0;        /* Empty buffer iff front == rear */
+    Sem_init(&sp->mutex, 0, 1);      /* Binary semaphore for locking */
+    Sem_init(&sp->slots, 0, n);      /* Initially, buf has n empty slots */
+    Sem_init(&sp->items, 0, 0);      /* Initially, buf has zero data items */
+}
+/* $end sbuf_init */
+
+/* Clean up buffer sp */
+/* $begin sbuf_deinit */
+void sbuf_deinit(sbuf_t *sp)
+{
+    Free(sp->buf);
+}
+/* $end sbuf_deinit */
+
+/* Insert item onto the rear of shared buffer sp */
+/* $begin sbuf_insert */
+void sbuf_insert(sbuf_t *sp, int item)
+{
+    P(&sp->slots);                          /* Wait for available slot */
+    P(&sp->mutex);                          /* Lock the buffer */
+    sp->buf[(++sp->rear)%(sp->n)] = item;   /* Insert the item */
+    V(&sp->mutex);                          /* Unlock the buffer */
+    V(&sp->items);                          /* Announce available item */
+}
+/* $end sbuf_insert */
+
+/* Take the front item out of sp, assumes sp->items was already taken */
+static int sbuf_take(sbuf_t *sp)
+{
+    int item;
+
+    P(&sp->mutex);                          /* Lock the buffer */
+    item = sp->buf[(++sp->front)%(sp->n)];  /* Remove the item */
+    V(&sp->mutex);                          /* Unlock the buffer */
+    V(&sp->slots);                          /* Announce available slot */
+    return item;
+}
+
+/* Remove and return the first item from buffer sp */
+/* $begin sbuf_remove */
+int sbuf_remove(sbuf_t *sp)
+{
+    P(&sp->items);                          /* Wait for available item */
+    return sbuf_take(sp);
+}
+/* $end sbuf_remove */
+
+/* Like sbuf_remove, but gives up and returns -1 after ms milliseconds */
+int sbuf_remove_timed(sbuf_t *sp, int ms)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (sem_timedwait(&sp->items, &deadline) < 0) {
+        if (errno == ETIMEDOUT)
+            return -1;
+        if (errno != EINTR)
+            unix_error("sbuf_remove_timed error");
+    }
+    return sbuf_take(sp);
+}
+
+/* Number of items waiting in sp (a snapshot, may be stale on return) */
+int sbuf_count(sbuf_t *sp)
+{
+    int items;
+
+    sem_getvalue(&sp->items, &items);
+    return items;
+}
+/* $end sbufc */
@@ -2,14 +2,57 @@
  * echoservert.c - A concurrent echo server using threads
  */
 /* $begin echoservertmain */
+#include <poll.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/random.h>
 #include "csapp.h"
+#include "trace.h"
+#include "sbuf.h"
+#include "terrain.h"
 
-// Number of cells vertically/horizontally in the grid
-#define GRIDSIZE 10
+// Level generation: a cell is a tomato when its random value is below
+// TOMATO_THRESHOLD (10% of 2^64). Boards of at least GEN_PARALLEL_CELLS
+// cells are filled by GEN_THREADS threads.
+#define TOMATO_THRESHOLD 0x199999999999999AULL
+#define GEN_PARALLEL_CELLS (256 * 256)
+#define GEN_THREADS 4
 
 
-void position(int connfd, int playerId);
-void *thread(void *vargp);
+// Worker pool defaults, overridable from the command line
+#define DEFAULT_WORKERS 4
+#define DEFAULT_STACK_KB 256
+#define MAX_WORKERS 64
+#define SBUFSIZE 64
+// an idle worker above the initial count exits after this long without a connection
+#define WORKER_IDLE_MS 30000
+
+// Player slots, a dropped player keeps theirs for RESUME_GRACE_SECS
+#define MAXPLAYERS 4
+#define RESUME_GRACE_SECS 30
+
+// State is pushed: every tick (SERVER_TICK_MS, TICK_MS in the environment
+// overrides it) the tick thread sends each client what changed. A side that
+// has sent nothing for KEEPALIVE_MS sends "k", and a side that hears nothing
+// for KEEPALIVE_TIMEOUT_MS drops the connection. "p,<n>" from a client is
+// answered with "q,<n>" right away, outside the tick, so it can time round trips.
+#define SERVER_TICK_MS 50
+#define KEEPALIVE_MS 2000
+#define KEEPALIVE_TIMEOUT_MS (3 * KEEPALIVE_MS)
+// a push that blocks this long means the client stopped reading
+#define SEND_TIMEOUT_MS 1000
+
+// Longest lines sent: a full state is at most 3 bytes a cell ("p1,") and a
+// delta at most the packed board (see encodeDelta), each with up to
+// LINE_HEADER_MAX bytes of header and trailer
+#define LINE_HEADER_MAX 256
+#define STATE_LINE_MAX (TERRAIN_CELLS * 3 + LINE_HEADER_MAX)
+#define DELTA_LINE_MAX (TERRAIN_PACKED_SIZE + LINE_HEADER_MAX)
+
+void position(rio_t *rio, rio_wt *wio, int localId, int generation, unsigned ackVersion);
+void serveClient(int connfd);
+void spawnWorker();
+void *worker(void *vargp);
 
 typedef struct
 {
@@ -19,391 +62,1008 @@ typedef struct
 
 typedef enum
 {
-    TILE_GRASS,
-    TILE_TOMATO
-} TILETYPE;
+    SLOT_FREE,
+    SLOT_CONNECTED,
+    SLOT_DETACHED  // connection dropped, waiting for the client to resume
+} SLOTSTATE;
+
+typedef struct
+{
+    SLOTSTATE state;
+    uint64_t token;   // handed to the client at join, presented again to resume
+    int generation;   // bumped on every attach so a stale connection can't detach a resumed slot
+    time_t detachedAt;
+    unsigned lastSeq; // sequence number of the last move processed, acked back to the client
+} Session;
+
+// the live board and the spare one the next level is generated into, the
+// number of tomatoes left is always terrainCount(grid)
+Terrain boards[2];
+Terrain *grid = &boards[0];
+Terrain *nextGrid = &boards[1];
+
+// slot i holds player i + 1, players[i] is (-1, -1) while the slot is free
+Position players[MAXPLAYERS];
+Session sessions[MAXPLAYERS];
 
-TILETYPE grid[GRIDSIZE][GRIDSIZE];
+// every change to the game state bumps stateVersion; cellVersion records the
+// version that last changed each cell so a resuming client only gets the delta
+unsigned stateVersion;
+unsigned cellVersion[TERRAIN_BITS]; // indexed by terrainBit(x, y)
+unsigned levelVersion; // version of the last board swap, every cell counts as changed then
 
-Position player1;
-Position player2;
-Position player3;
-Position player4;
+// a connection the tick thread pushes state to, one per player slot
+typedef struct
+{
+    bool active;
+    bool ready;            // initial state written, the tick thread may write from now on
+    int generation;        // of the session that subscribed
+    unsigned sentVersion;  // the client has everything up to this version
+    unsigned sentAck;      // and knows its moves up to this sequence number were processed
+    long lastSentMs;
+    pthread_mutex_t sendLock; // held while writing to wio, and while its socket is closed
+    rio_wt wio;
+} Subscriber;
 
-int freeX;
-int freeY;
 int score;
 int level;
-int numTomatoes;
-int playerId = 0;
 pthread_mutex_t lock;
 
-// get a random value in the range [0, 1]
-double rand01()
+int tickMs;
+long startMs; // updates carry the time since this, clients interpolate on it
+
+// subscribersLock guards the subscribers' fields and is only held for a moment,
+// never together with lock; a write can block for SEND_TIMEOUT_MS, so it is done
+// under the subscriber's own sendLock (taken before subscribersLock if both are)
+Subscriber subscribers[MAXPLAYERS];
+pthread_mutex_t subscribersLock = PTHREAD_MUTEX_INITIALIZER;
+
+// the room's seed, every level it generates is a pure function of (seed, level)
+uint64_t roomSeed;
+
+// the level generator thread fills nextGrid with level + 1 in the background:
+// nextLevelWanted asks for it, nextLevelReady announces it is done
+sem_t nextLevelWanted;
+sem_t nextLevelReady;
+
+// prethreaded worker pool: accepted descriptors are queued in connections
+sbuf_t connections;
+pthread_attr_t workerAttr;
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+int minWorkers;
+int numWorkers; // guarded by poolLock
+int idleWorkers; // guarded by poolLock
+
+long nowNs()
 {
-    return (double) rand() / (double) RAND_MAX;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
 }
 
-void initGrid()
+long nowMs()
 {
-    for (int i = 0; i < GRIDSIZE; i++) {
-        for (int j = 0; j < GRIDSIZE; j++) {
-            double r = rand01();
-            if (r < 0.1) {
-                grid[i][j] = TILE_TOMATO;
-                numTomatoes++;
-            }
-            else
-                grid[i][j] = TILE_GRASS;
+    return nowNs() / 1000000;
+}
+
+/*
+ * Lock profiling - build with -DLOCK_PROFILE (make LOCKPROF=1) to record how
+ * long each critical section waits for and holds the global lock. A summary
+ * is printed every LOCK_PROFILE_INTERVAL seconds (default 10, can be
+ * overridden from the environment). Without the flag LOCK/UNLOCK are plain
+ * pthread_mutex_lock/unlock calls.
+ */
+typedef enum
+{
+    SITE_JOIN,           // joining or resuming in serveClient()
+    SITE_LEAVE,          // detaching the session in serveClient()
+    SITE_INITIAL_ENCODE, // first grid encode in position()
+    SITE_MOVE_UPDATE,    // per-move update in position()
+    SITE_BROADCAST,      // encoding the pushed state in broadcaster()
+    NUM_LOCK_SITES
+} LOCKSITE;
+
+#ifdef LOCK_PROFILE
+typedef struct
+{
+    const char *name;
+    int line;            // source line of the LOCK() call
+    long count;
+    long waitTotalNs;
+    long waitMaxNs;
+    long holdTotalNs;
+    long holdMaxNs;
+} LockStats;
+
+const char *lockSiteNames[NUM_LOCK_SITES] = {"join", "leave", "initial-encode", "move-update", "broadcast"};
+LockStats lockStats[NUM_LOCK_SITES];
+long lockHeldSince; // only written by the current holder
+
+void lockAcquire(LOCKSITE site, int line)
+{
+    long start = nowNs();
+    pthread_mutex_lock(&lock);
+    lockHeldSince = nowNs();
+
+    // stats are only touched while holding the lock itself
+    LockStats *s = &lockStats[site];
+    long wait = lockHeldSince - start;
+    s->name = lockSiteNames[site];
+    s->line = line;
+    s->count++;
+    s->waitTotalNs += wait;
+    if (wait > s->waitMaxNs)
+        s->waitMaxNs = wait;
+}
+
+void lockRelease(LOCKSITE site)
+{
+    LockStats *s = &lockStats[site];
+    long hold = nowNs() - lockHeldSince;
+    s->holdTotalNs += hold;
+    if (hold > s->holdMaxNs)
+        s->holdMaxNs = hold;
+    pthread_mutex_unlock(&lock);
+}
+
+//prints one line per call site, each share is relative to the total hold time
+void *lockSummary(void *vargp)
+{
+    int interval = *((int *)vargp);
+    Pthread_detach(pthread_self());
+
+    while (1) {
+        sleep(interval);
+
+        LockStats snap[NUM_LOCK_SITES];
+        pthread_mutex_lock(&lock);
+        memcpy(snap, lockStats, sizeof(snap));
+        pthread_mutex_unlock(&lock);
+
+        long totalHold = 0;
+        for (int i = 0; i < NUM_LOCK_SITES; i++)
+            totalHold += snap[i].holdTotalNs;
+
+        printf("lock profile (cumulative, printed every %ds):\n", interval);
+        printf("  %-16s %6s %10s %10s %10s %10s %10s %6s\n", "site", "line", "count",
+               "wait avg", "wait max", "hold avg", "hold max", "share");
+        for (int i = 0; i < NUM_LOCK_SITES; i++) {
+            LockStats *s = &snap[i];
+            if (s->count == 0)
+                continue;
+            printf("  %-16s %6d %10ld %8ldus %8ldus %8ldus %8ldus %5.1f%%\n", s->name, s->line,
+                   s->count, s->waitTotalNs / s->count / 1000, s->waitMaxNs / 1000,
+                   s->holdTotalNs / s->count / 1000, s->holdMaxNs / 1000,
+                   totalHold ? 100.0 * s->holdTotalNs / totalHold : 0.0);
         }
+        fflush(stdout);
     }
+    return NULL;
+}
 
-    /*
-    // force player's position to be grass
-    if (grid[player1.x][player1.y] == TILE_TOMATO) {
-        grid[player1.x][player1.y] = TILE_GRASS;
-        numTomatoes--;
-    }
-    */
+void startLockProfiler()
+{
+    static int interval = 10;
+    char *env = getenv("LOCK_PROFILE_INTERVAL");
+    if (env != NULL && atoi(env) > 0)
+        interval = atoi(env);
 
-    // ensure grid isn't empty
-    while (numTomatoes == 0)
-        initGrid();
+    pthread_t tid;
+    Pthread_create(&tid, NULL, lockSummary, &interval);
 }
 
-//finding a spot on grid that is grass and storing it into freeX and freeY
-void findFreeSpot (int spot) {
-    freeX = 100;
-    freeY = 100;
+#define LOCK(site) lockAcquire(site, __LINE__)
+#define UNLOCK(site) lockRelease(site)
+#else
+#define LOCK(site) pthread_mutex_lock(&lock)
+#define UNLOCK(site) pthread_mutex_unlock(&lock)
+#endif
 
-    for (int x = 0; x < GRIDSIZE; x++) {
-        for (int y = 0; y < GRIDSIZE; y++) {
-            //first player
-            if (spot == 1) {
-                if (grid[x][y] == TILE_GRASS) {
-                    freeX = x;
-                    freeY = y;
-                    return;
-                }
-            }
-            //second player (must make sure not taking player1's position)
-            else if (spot == 2) {
-                if (grid[x][y] == TILE_GRASS && x != player1.x && y != player1.y) {
-                    freeX = x;
-                    freeY = y;
-                    return;
-                }
-            } 
-            //third player (must make sure not taking other player's position)
-            else if (spot == 3) {
-                if (grid[x][y] == TILE_GRASS && x != player1.x && y != player1.y && x != player2.x && y != player2.y) {
-                    freeX = x;
-                    freeY = y;
-                    return;
-                }
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ULL
+
+//splitmix64 finalizer, a cheap bijective 64-bit mix
+static inline uint64_t mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+//counter-based random value for one cell: position index of a splitmix64 stream keyed by seed and level
+static inline uint64_t cellRandom(uint64_t key, uint64_t index)
+{
+    return mix64(key + (index + 1) * GOLDEN_GAMMA);
+}
+
+//record a terrain change for resuming clients
+void touchCell(int x, int y)
+{
+    cellVersion[terrainBit(x, y)] = ++stateVersion;
+}
+
+typedef struct
+{
+    Terrain *board;
+    uint64_t key;
+    size_t firstWord;
+    size_t endWord;
+} GenJob;
+
+//fill bitboard words [firstWord, endWord): each word is an 8x8 tile, its bits are
+//computed branch-free from the cell stream (cell (x, y) uses position y * GRIDSIZE + x,
+//so a seed gives the same level whatever the memory layout)
+void *generateWords(void *vargp)
+{
+    GenJob *job = vargp;
+
+    for (size_t w = job->firstWord; w < job->endWord; w++) {
+        int left = (w % TERRAIN_TILES_PER_ROW) * 8;
+        int top = (w / TERRAIN_TILES_PER_ROW) * 8;
+        uint64_t mask = 0;
+
+        for (int y = top; y < top + 8 && y < GRIDSIZE; y++) {
+            for (int x = left; x < left + 8 && x < GRIDSIZE; x++) {
+                uint64_t r = cellRandom(job->key, (uint64_t) y * GRIDSIZE + x);
+                mask |= (uint64_t) (r < TOMATO_THRESHOLD) << terrainCell(x, y);
             }
-            //fourth player (must make sure not taking other player's position)
-            else if (spot == 4) {
-                if (grid[x][y] == TILE_GRASS && x != player1.x && y != player1.y && x != player2.x && y != player2.y && x != player3.x && y != player3.y) {
-                    freeX = x;
-                    freeY = y;
-                    return;
-                }
-            }  
         }
+        job->board->words[w] = mask;
     }
-    return;
+    return NULL;
 }
 
-int main(int argc, char **argv) 
+//generate level levelNumber into board, large boards are split into word bands across threads
+void generateLevel(Terrain *board, int levelNumber)
 {
-    srand(time(NULL));
+    uint64_t key = mix64(roomSeed + (uint64_t) levelNumber * GOLDEN_GAMMA);
+    int threads = (TERRAIN_CELLS >= GEN_PARALLEL_CELLS) ? GEN_THREADS : 1;
+    GenJob jobs[GEN_THREADS];
+    pthread_t tids[GEN_THREADS];
 
-    if (pthread_mutex_init(&lock, NULL) != 0) {
-        printf("\n mutex init has failed\n");
-        return 1;
+    for (int i = 0; i < threads; i++) {
+        jobs[i].board = board;
+        jobs[i].key = key;
+        jobs[i].firstWord = TERRAIN_WORDS * i / threads;
+        jobs[i].endWord = TERRAIN_WORDS * (i + 1) / threads;
     }
+    for (int i = 1; i < threads; i++)
+        Pthread_create(&tids[i], NULL, generateWords, &jobs[i]);
+    generateWords(&jobs[0]);
+    for (int i = 1; i < threads; i++)
+        Pthread_join(tids[i], NULL);
 
-    //creating socket variables
-    int listenfd, *connfdp;
-    socklen_t clientlen;
-    struct sockaddr_storage clientaddr;
-    pthread_t tid; 
-
-    if (argc != 2) {
-	fprintf(stderr, "usage: %s <port>\n", argv[0]);
-	exit(0);
+    // ensure grid isn't empty: place one tomato at a cell picked from the same stream
+    if (terrainCount(board) == 0) {
+        uint64_t cell = cellRandom(key, TERRAIN_CELLS) % TERRAIN_CELLS;
+        terrainSetTomato(board, cell % GRIDSIZE, cell / GRIDSIZE);
     }
-    
-    //create player position and create the grid
-    player1.x = -1;
-    player1.y = -1;
+}
+
+//background thread: builds the level after the current one into the spare board
+//without holding the lock, nextGrid is only swapped once nextLevelReady is posted
+void *levelGenerator(void *vargp)
+{
+    Pthread_detach(pthread_self());
 
-    player2.x = -1;
-    player2.y = -1;
+    while (1) {
+        P(&nextLevelWanted);
+        int levelNumber = level + 1; // level only changes in nextLevel(), before it posts nextLevelWanted
+        generateLevel(nextGrid, levelNumber);
+        V(&nextLevelReady);
+    }
+    return NULL;
+}
 
-    player3.x = -1;
-    player3.y = -1;
+//switch to the pre-generated next level, called with the lock held; only waits if the
+//level was cleared before the generator finished
+void nextLevel()
+{
+    P(&nextLevelReady);
 
-    player4.x = -1;
-    player4.y = -1;
+    Terrain *old = grid;
+    grid = nextGrid;
+    nextGrid = old;
+    level++;
+    levelVersion = ++stateVersion;
 
-    initGrid();
-    level = 1;
+    V(&nextLevelWanted);
+}
 
-    //establish connection with client
-    listenfd = Open_listenfd(argv[1]);
+bool playerActive(int slot)
+{
+    return sessions[slot].state != SLOT_FREE;
+}
 
-    //when new clients connects, create new thread (multithreading)
-    while (1) {
-        
-        clientlen=sizeof(struct sockaddr_storage);
-	    connfdp = Malloc(sizeof(int)); //line:conc:echoservert:beginmalloc
-	    *connfdp = Accept(listenfd, (SA *) &clientaddr, &clientlen); //line:conc:echoservert:endmalloc
-	    Pthread_create(&tid, NULL, thread, connfdp);
+//is (x, y) taken by a player other than the one in slot except
+bool occupied(int x, int y, int except)
+{
+    for (int i = 0; i < MAXPLAYERS; i++) {
+        if (i != except && playerActive(i) && players[i].x == x && players[i].y == y)
+            return true;
     }
+    return false;
 }
 
-//inside the new thread (new client)
-void *thread(void *vargp) 
-{  
-    int connfd = *((int *)vargp);
-    Pthread_detach(pthread_self()); //line:conc:echoservert:detach
-    Free(vargp);                    //line:conc:echoservert:free
-    
-    //call game related stuff
-    int localPlayerId = 0;
-    pthread_mutex_lock(&lock);
-    playerId++;
-    localPlayerId = playerId;
-    findFreeSpot(playerId);
-    if (playerId == 1) {
-        player1.x = freeX;
-        player1.y = freeY;
+//finding a spot on grid that is grass and not taken by another player
+bool findFreeSpot(Position *pos)
+{
+    for (int x = 0; x < GRIDSIZE; x++) {
+        for (int y = 0; y < GRIDSIZE; y++) {
+            if (!terrainHasTomato(grid, x, y) && !occupied(x, y, -1)) {
+                pos->x = x;
+                pos->y = y;
+                return true;
+            }
+        }
     }
-    else if (playerId == 2) {
-        player2.x = freeX;
-        player2.y = freeY;
+    return false;
+}
+
+//free the slots of players that didn't come back within the grace window
+void expireSessions()
+{
+    time_t now = time(NULL);
+
+    for (int i = 0; i < MAXPLAYERS; i++) {
+        if (sessions[i].state == SLOT_DETACHED && now - sessions[i].detachedAt >= RESUME_GRACE_SECS) {
+            sessions[i].state = SLOT_FREE;
+            players[i].x = -1;
+            players[i].y = -1;
+            stateVersion++;
+        }
     }
-    else if (playerId == 3) {
-        player3.x = freeX;
-        player3.y = freeY;
+}
+
+//handle the client's hello ("j" to join, "r,<token>,<version>" to resume) and
+//return the player's slot or -1 if the game is full, *ackVersion is the state
+//the client already has (0 for none)
+int attachSession(char *hello, int *generation, unsigned *ackVersion)
+{
+    uint64_t token;
+    unsigned version;
+
+    *ackVersion = 0;
+    if (sscanf(hello, "r,%" SCNx64 ",%u", &token, &version) == 2) {
+        for (int i = 0; i < MAXPLAYERS; i++) {
+            if (playerActive(i) && sessions[i].token == token) {
+                // a still-connected slot means the old connection hasn't noticed the drop yet
+                sessions[i].state = SLOT_CONNECTED;
+                *generation = ++sessions[i].generation;
+                if (version <= stateVersion)
+                    *ackVersion = version;
+                return i;
+            }
+        }
     }
-    else if (playerId == 4) {
-        player4.x = freeX;
-        player4.y = freeY;
+
+    // unknown or expired token: join as a new player
+    for (int i = 0; i < MAXPLAYERS; i++) {
+        if (sessions[i].state != SLOT_FREE)
+            continue;
+        if (!findFreeSpot(&players[i]))
+            return -1;
+        if (getrandom(&sessions[i].token, sizeof(sessions[i].token), 0) != sizeof(sessions[i].token))
+            sessions[i].token = mix64(roomSeed ^ mix64(time(NULL) + stateVersion * GOLDEN_GAMMA + i));
+        sessions[i].state = SLOT_CONNECTED;
+        sessions[i].lastSeq = 0;
+        *generation = ++sessions[i].generation;
+        stateVersion++;
+        return i;
     }
-    pthread_mutex_unlock(&lock);
-    position(connfd, localPlayerId);
-    Close(connfd);
-    return NULL;
+    return -1;
 }
 
-void position(int connfd, int localId) 
-{   
-    char buf[MAXLINE] = "";
-    //int localId = playerId;
+//append an int followed by sep to the buffer at p, returns the new end, or end once
+//the buffer is full so the encoder can tell the line didn't fit
+char *putInt(char *p, char *end, int value, char sep)
+{
+    int n = snprintf(p, end - p, "%d%c", value, sep);
+    return (n < 0 || n >= end - p) ? end : p + n;
+}
 
-    size_t n; 
-    rio_t rio;
-    //puts("start of function");
-    Rio_readinitb(&rio, connfd);
+//number of characters value takes in decimal
+int intLength(unsigned value)
+{
+    int n = 1;
+    for (; value >= 10; value /= 10)
+        n++;
+    return n;
+}
+
+//full state: one entry per cell (y outer, x inner), then score, tomatoes, level, id and version;
+//returns the line's length, 0 if it doesn't fit in cap bytes
+size_t encodeState(char *buf, size_t cap, int localId)
+{
+    char *p = buf, *end = buf + cap;
 
-    pthread_mutex_lock(&lock);
-    //encoding the grid into buf (100 chars)
     for (int y = 0; y < GRIDSIZE; y++) {
+        if (end - p <= 3 * GRIDSIZE)
+            return 0;
         for (int x = 0; x < GRIDSIZE; x++) {
-            if (player1.x == x && player1.y == y) { //player1
-                strcat(buf, "p1,");
-            }
-            else if (playerId >= 2 && player2.x == x && player2.y == y) { //player 2
-                strcat(buf, "p2,");
-            }
-            else if (playerId >= 3 && player3.x == x && player3.y == y) { //player 3
-                strcat(buf, "p3,");
+            int player = -1;
+            for (int i = 0; i < MAXPLAYERS && player < 0; i++) {
+                if (playerActive(i) && players[i].x == x && players[i].y == y)
+                    player = i;
             }
-            else if (playerId >= 4 && player4.x == x && player4.y == y) { //player 4
-                strcat(buf, "p4,");
-            }
-            else if (grid[x][y] == TILE_TOMATO) { //tomato
-                strcat(buf, "1,");
+
+            if (player >= 0) { //player1-4
+                *p++ = 'p';
+                *p++ = '1' + player;
             }
-            else { //grass
-                strcat(buf, "0,");
+            else if (terrainHasTomato(grid, x, y)) //tomato
+                *p++ = '1';
+            else //grass
+                *p++ = '0';
+            *p++ = ',';
+        }
+    }
+    p = putInt(p, end, score, ',');
+    p = putInt(p, end, terrainCount(grid), ',');
+    p = putInt(p, end, level, ',');
+    p = putInt(p, end, localId, ',');
+    p = putInt(p, end, stateVersion, '\n');
+    if (p == end)
+        return 0;
+    *p = '\0';
+    return p - buf;
+}
+
+//delta since ackVersion: "d,version,time,score,tomatoes,level,id,ack,x1,y1,..,x4,y4,count" followed
+//by count "cell index,tile" pairs (time = server ms, cell index = y * GRIDSIZE + x, players at
+//(-1, -1) are absent);
+//after a level change, or when the pairs would be longer, count is -1 and the whole board
+//follows packed (see terrainPack), so a delta never needs more than DELTA_LINE_MAX;
+//ack is the player's last processed move. Returns the line's length (0 if it doesn't fit
+//in cap bytes) and sets *idAt to the offset of the id field so a line encoded with id and
+//ack 0 can be sent to every player with their own spliced in
+size_t encodeDelta(char *buf, size_t cap, int localId, unsigned ack, unsigned ackVersion, size_t *idAt)
+{
+    char *p = buf, *end = buf + cap;
+    int count = 0;
+    size_t pairBytes = 0;
+
+    bool packed = levelVersion > ackVersion;
+
+    for (int y = 0; y < GRIDSIZE && !packed; y++) {
+        for (int x = 0; x < GRIDSIZE; x++) {
+            if (cellVersion[terrainBit(x, y)] > ackVersion) {
+                count++;
+                pairBytes += intLength(y * GRIDSIZE + x) + 3; // "cell,tile,"
             }
         }
+        packed = pairBytes >= TERRAIN_PACKED_SIZE;
     }
-    char intToChar[10];
 
-    sprintf(intToChar, "%d", score);
-    strcat(buf, intToChar);
-    strcat(buf, ",");
+    *p++ = 'd';
+    *p++ = ',';
+    p = putInt(p, end, stateVersion, ',');
+    p = putInt(p, end, nowMs() - startMs, ',');
+    p = putInt(p, end, score, ',');
+    p = putInt(p, end, terrainCount(grid), ',');
+    p = putInt(p, end, level, ',');
+    *idAt = p - buf;
+    p = putInt(p, end, localId, ',');
+    p = putInt(p, end, ack, ',');
+    for (int i = 0; i < MAXPLAYERS; i++) {
+        p = putInt(p, end, playerActive(i) ? players[i].x : -1, ',');
+        p = putInt(p, end, playerActive(i) ? players[i].y : -1, ',');
+    }
+    if (packed) {
+        p = putInt(p, end, -1, ',');
+        if ((size_t) (end - p) < TERRAIN_PACKED_SIZE + 1)
+            return 0;
+        p += terrainPack(grid, p);
+        *p++ = '\n';
+        *p = '\0';
+        return p - buf;
+    }
 
-    sprintf(intToChar, "%d", numTomatoes);
-    strcat(buf, intToChar);
-    strcat(buf, ",");
+    p = putInt(p, end, count, count ? ',' : '\n');
+    for (int y = 0; y < GRIDSIZE && count > 0; y++) {
+        for (int x = 0; x < GRIDSIZE; x++) {
+            if (cellVersion[terrainBit(x, y)] > ackVersion) {
+                p = putInt(p, end, y * GRIDSIZE + x, ',');
+                p = putInt(p, end, terrainHasTomato(grid, x, y), --count ? ',' : '\n');
+            }
+        }
+    }
+    if (p == end)
+        return 0;
+    *p = '\0';
+    return p - buf;
+}
 
-    sprintf(intToChar, "%d", level);
-    strcat(buf, intToChar);
-    strcat(buf, ",");
+//move the player in slot one square by (dx, dy) unless that leaves the grid or another player is there
+void movePlayer(int slot, int dx, int dy)
+{
+    int x = players[slot].x + dx;
+    int y = players[slot].y + dy;
 
-    sprintf(intToChar, "%d", localId);
-    strcat(buf, intToChar);
-    strcat(buf, "\n");
-    
-    //printf("inital id is: %d\n", localId);
+    if (abs(dx) + abs(dy) != 1 || x < 0 || x >= GRIDSIZE || y < 0 || y >= GRIDSIZE || occupied(x, y, slot))
+        return;
+    players[slot].x = x;
+    players[slot].y = y;
+    stateVersion++;
+}
 
-    pthread_mutex_unlock(&lock);
+//a player standing on a tomato picks it up, the last tomato starts the next level
+void pickUpTomatoes()
+{
+    for (int i = 0; i < MAXPLAYERS; i++) {
+        if (!playerActive(i) || !terrainTakeTomato(grid, players[i].x, players[i].y))
+            continue;
 
-    //sending the intial positions to client
-    Rio_writen(connfd, buf, strlen(buf));
-    strcpy(buf, "");
-    char* p;
-    char * temp[200];
-    int length;
-    int tempcounter = 0;
+        touchCell(players[i].x, players[i].y);
+        score++;
 
-    //continiously read from client
-    while((n = Rio_readlineb(&rio, buf, MAXLINE)) != 0) { //line:netp:echo:eof
-       //puts("start of loop");
-        //do your parsing here and add into local variable
-        length = strlen(buf);
-        p = strtok(buf, ",");
-
-        //storing values from buf into temp array
-        for (size_t i = 0; i < length; i++) {
-            if (p) {
-                temp[i] = p;
-            }
-            p = strtok(NULL, ",");
+        //players standing on the new level's tomatoes pick those up too
+        if (terrainCount(grid) == 0) {
+            nextLevel();
+            i = -1;
         }
+    }
+}
 
-        //printf("now id is: %d\n", localId);
+//register the connection for pushes once the client has everything up to version (and
+//moves up to ack); the tick thread leaves it alone until it is marked ready. A connection
+//still registered for the slot was taken over by a resume: shutting it down wakes its
+//worker, which then finds its generation stale. False if a newer one got there first
+bool subscribe(int slot, int generation, int connfd, unsigned version, unsigned ack)
+{
+    Subscriber *sub = &subscribers[slot];
+    bool current;
 
-        pthread_mutex_lock(&lock);
+    pthread_mutex_lock(&sub->sendLock);
+    pthread_mutex_lock(&subscribersLock);
+    current = sub->generation <= generation;
+    if (current) {
+        if (sub->active && sub->generation < generation)
+            shutdown(sub->wio.rio_fd, SHUT_RDWR);
+        sub->active = true;
+        sub->ready = false;
+        sub->generation = generation;
+        sub->sentVersion = version;
+        sub->sentAck = ack;
+        Rio_writeinitb(&sub->wio, connfd);
+    }
+    pthread_mutex_unlock(&subscribersLock);
+    pthread_mutex_unlock(&sub->sendLock);
+    return current;
+}
 
-        //saving player positions based on localId
-        int tempx = atoi(temp[tempcounter]);
-        tempcounter++;
-        int tempy = atoi(temp[tempcounter]);
+//a push failed or timed out: let the connection's worker see EOF and detach the session;
+//called with sub's sendLock held
+void dropSubscriber(Subscriber *sub)
+{
+    pthread_mutex_lock(&subscribersLock);
+    sub->active = false;
+    pthread_mutex_unlock(&subscribersLock);
+    shutdown(sub->wio.rio_fd, SHUT_RDWR);
+}
 
-        if (localId == 1) {
-            if ((tempx != player2.x || tempy != player2.y) && (tempx != player3.x || tempy != player3.y) && (tempx != player4.x || tempy != player4.y)) {
-                player1.x = tempx;
-                player1.y = tempy;
-            }
+//tick thread: every tickMs send each subscriber the delta since what it last got
+//(or a new ack for its moves), or "k" after KEEPALIVE_MS of silence. Subscribers that are
+//at the same version (normally all of them) share one encoded line, with only their
+//player id and ack spliced in.
+void *broadcaster(void *vargp)
+{
+    char *shared = Malloc(DELTA_LINE_MAX);
+    char *own[MAXPLAYERS];
+    char ids[MAXPLAYERS][24];
+    struct iovec iov[MAXPLAYERS][3];
+    int iovcnt[MAXPLAYERS];
+    // what each subscriber had at the start of the tick
+    bool live[MAXPLAYERS];
+    int generations[MAXPLAYERS];
+    unsigned since[MAXPLAYERS], acks[MAXPLAYERS];
+    struct timespec next;
+
+    Pthread_detach(pthread_self());
+    for (int i = 0; i < MAXPLAYERS; i++)
+        own[i] = Malloc(DELTA_LINE_MAX);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (1) {
+        next.tv_nsec += tickMs * 1000000L;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
         }
-        else if (localId == 2) {
-            if ((tempx != player1.x || tempy != player1.y) && (tempx != player3.x || tempy != player3.y) && (tempx != player4.x || tempy != player4.y)) {
-                player2.x = tempx;
-                player2.y = tempy;
-            }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        uint64_t traceStep = TRACE_START();
+        bool haveShared = false;
+        unsigned sharedSince = 0, version;
+        size_t idAt = 0;
+        size_t sharedLength = 0;
+
+        pthread_mutex_lock(&subscribersLock);
+        for (int i = 0; i < MAXPLAYERS; i++) {
+            live[i] = subscribers[i].active && subscribers[i].ready;
+            generations[i] = subscribers[i].generation;
+            since[i] = subscribers[i].sentVersion;
+            acks[i] = subscribers[i].sentAck;
         }
-        else if (localId == 3) {
-            if ((tempx != player1.x || tempy != player1.y) && (tempx != player2.x || tempy != player2.y) && (tempx != player4.x || tempy != player4.y)) {
-                player3.x = tempx;
-                player3.y = tempy;
+        pthread_mutex_unlock(&subscribersLock);
+
+        LOCK(SITE_BROADCAST);
+        expireSessions();
+        version = stateVersion;
+        for (int i = 0; i < MAXPLAYERS; i++) {
+            unsigned ack = sessions[i].lastSeq;
+
+            iovcnt[i] = 0;
+            if (!live[i] || (since[i] == stateVersion && acks[i] == ack))
+                continue;
+            if (!haveShared) {
+                sharedLength = encodeDelta(shared, DELTA_LINE_MAX, 0, 0, since[i], &idAt);
+                sharedSince = since[i];
+                haveShared = true;
             }
-        }
-        else if (localId == 4) {
-            if ((tempx != player1.x || tempy != player1.y) && (tempx != player3.x || tempy != player3.y) && (tempx != player2.x || tempy != player2.y)) {
-                player4.x = tempx;
-                player4.y = tempy;
+            if (since[i] == sharedSince && sharedLength > 0) {
+                iov[i][0] = (struct iovec) {shared, idAt};
+                iov[i][1] = (struct iovec) {ids[i], sprintf(ids[i], "%d,%u", i + 1, ack)};
+                iov[i][2] = (struct iovec) {shared + idAt + 3, sharedLength - idAt - 3}; // past "0,0"
+                iovcnt[i] = 3;
+            }
+            else {
+                size_t ownIdAt;
+                iov[i][0] = (struct iovec) {own[i], encodeDelta(own[i], DELTA_LINE_MAX, i + 1, ack, since[i], &ownIdAt)};
+                iovcnt[i] = 1;
             }
+            acks[i] = ack;
         }
+        UNLOCK(SITE_BROADCAST);
+        TRACE_END("broadcast encode", traceStep);
 
-        tempcounter = 0;
-        strcpy(buf, "");
+        //writing with neither lock held, a client that stopped reading fails after
+        //SEND_TIMEOUT_MS and only holds up its own sendLock meanwhile
+        traceStep = TRACE_START();
+        long now = nowMs();
+        for (int i = 0; i < MAXPLAYERS; i++) {
+            Subscriber *sub = &subscribers[i];
 
-        //checking if all players has obtained a tomato
-        if (grid[player1.x][player1.y] == TILE_TOMATO) {
-            grid[player1.x][player1.y] = TILE_GRASS;
-            score++;
-            numTomatoes--;
-
-            if (numTomatoes == 0) {
-                level++;
-                initGrid();
-            }
-        }
-        if (playerId >= 2 && grid[player2.x][player2.y] == TILE_TOMATO) {
-            grid[player2.x][player2.y] = TILE_GRASS;
-            score++;
-            numTomatoes--;
-            if (numTomatoes == 0) {
-                level++;
-                initGrid();
+            //a ping reply being written: catch up on the next tick rather than wait behind it
+            if (!live[i] || pthread_mutex_trylock(&sub->sendLock) != 0)
+                continue;
+            //still the connection the line was encoded for (it can't change while we hold sendLock)
+            pthread_mutex_lock(&subscribersLock);
+            bool send = sub->active && sub->generation == generations[i] &&
+                        (iovcnt[i] > 0 || now - sub->lastSentMs >= KEEPALIVE_MS);
+            if (send) {
+                if (iovcnt[i] > 0) {
+                    sub->sentVersion = version;
+                    sub->sentAck = acks[i];
+                }
+                sub->lastSentMs = now;
             }
-        }
-        if (playerId >= 3 && grid[player3.x][player3.y] == TILE_TOMATO) {
-            grid[player3.x][player3.y] = TILE_GRASS;
-            score++;
-            numTomatoes--;
-            if (numTomatoes == 0) {
-                level++;
-                initGrid();
+            pthread_mutex_unlock(&subscribersLock);
+
+            if (send) {
+                if (iovcnt[i] > 0)
+                    rio_writevb(&sub->wio, iov[i], iovcnt[i]);
+                else
+                    rio_writeb(&sub->wio, "k\n", 2);
+                if (rio_flushb(&sub->wio) < 0)
+                    dropSubscriber(sub);
             }
+            pthread_mutex_unlock(&sub->sendLock);
         }
-        if (playerId >= 4 && grid[player4.x][player4.y] == TILE_TOMATO) {
-            grid[player4.x][player4.y] = TILE_GRASS;
-            score++;
-            numTomatoes--;
-            if (numTomatoes == 0) {
-                level++;
-                initGrid();
-            }
+        TRACE_END("broadcast send", traceStep);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) 
+{
+    //the server has no way out but being killed, so on Ctrl-C tracing writes its file and exits
+    traceInit("server", NULL);
+
+    //SEED in the environment replays the same sequence of levels
+    char *seed = getenv("SEED");
+    roomSeed = seed ? strtoull(seed, NULL, 0) : mix64(time(NULL) ^ ((uint64_t) getpid() << 32));
+    printf("room seed %" PRIu64 "\n", roomSeed);
+    fflush(stdout);
+
+    char *tick = getenv("TICK_MS");
+    tickMs = tick ? atoi(tick) : SERVER_TICK_MS;
+    if (tickMs < 1 || tickMs > 1000)
+        tickMs = SERVER_TICK_MS;
+    startMs = nowMs();
+
+    if (pthread_mutex_init(&lock, NULL) != 0) {
+        printf("\n mutex init has failed\n");
+        return 1;
+    }
+#ifdef LOCK_PROFILE
+    startLockProfiler();
+#endif
+
+    //creating socket variables
+    int listenfd, connfd;
+    socklen_t clientlen;
+    struct sockaddr_storage clientaddr;
+
+    if (argc < 2 || argc > 4) {
+	fprintf(stderr, "usage: %s <port> [workers] [stack KB]\n", argv[0]);
+	exit(0);
+    }
+    minWorkers = (argc > 2) ? atoi(argv[2]) : DEFAULT_WORKERS;
+    int stackKb = (argc > 3) ? atoi(argv[3]) : DEFAULT_STACK_KB;
+    if (minWorkers < 1 || minWorkers > MAX_WORKERS || stackKb < PTHREAD_STACK_MIN / 1024) {
+	fprintf(stderr, "workers must be 1-%d and stack at least %d KB\n", MAX_WORKERS, (int) (PTHREAD_STACK_MIN / 1024));
+	exit(0);
+    }
+    
+    //clients come and go, a write to a dropped one must fail instead of killing the server
+    Signal(SIGPIPE, SIG_IGN);
+
+    //create player position and create the grid
+    for (int i = 0; i < MAXPLAYERS; i++) {
+        players[i].x = -1;
+        players[i].y = -1;
+        pthread_mutex_init(&subscribers[i].sendLock, NULL);
+    }
+
+    level = 1;
+    generateLevel(grid, level);
+    levelVersion = ++stateVersion;
+
+    //start building level 2 right away
+    pthread_t tid;
+    Sem_init(&nextLevelWanted, 0, 1);
+    Sem_init(&nextLevelReady, 0, 0);
+    Pthread_create(&tid, NULL, levelGenerator, NULL);
+    Pthread_create(&tid, NULL, broadcaster, NULL);
+
+    //establish connection with client
+    listenfd = Open_listenfd(argv[1]);
+
+    //prethread the worker pool, accepted connections are handed over through the sbuf
+    sbuf_init(&connections, SBUFSIZE);
+    pthread_attr_init(&workerAttr);
+    pthread_attr_setdetachstate(&workerAttr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&workerAttr, (size_t) stackKb * 1024);
+    for (int i = 0; i < minWorkers; i++)
+        spawnWorker();
+
+    while (1) {
+        clientlen=sizeof(struct sockaddr_storage);
+        connfd = Accept(listenfd, (SA *) &clientaddr, &clientlen);
+
+        //grow when every worker is busy, doubling up to MAX_WORKERS
+        pthread_mutex_lock(&poolLock);
+        int grow = 0;
+        if (idleWorkers <= sbuf_count(&connections)) {
+            grow = numWorkers;
+            if (numWorkers + grow > MAX_WORKERS)
+                grow = MAX_WORKERS - numWorkers;
         }
+        pthread_mutex_unlock(&poolLock);
+        for (int i = 0; i < grow; i++)
+            spawnWorker();
 
-        //encoding the grid into buf (100 chars)
-        for (int y = 0; y < GRIDSIZE; y++) {
-            for (int x = 0; x < GRIDSIZE; x++) {
-                if (player1.x == x && player1.y == y) { //player1
-                    strcat(buf, "p1,");
-                }
-                else if (playerId >= 2 && player2.x == x && player2.y == y) { //player 2
-                    strcat(buf, "p2,");
-                }
-                else if (playerId >= 3 && player3.x == x && player3.y == y) { //player 3
-                    strcat(buf, "p3,");
-                }
-                else if (playerId >= 4 && player4.x == x && player4.y == y) { //player 4
-                    strcat(buf, "p4,");
-                }
-                else if (grid[x][y] == TILE_TOMATO) { //tomato
-                    strcat(buf, "1,");
-                }
-                else { //grass
-                    strcat(buf, "0,");
-                }
+        sbuf_insert(&connections, connfd);
+    }
+}
+
+void spawnWorker()
+{
+    pthread_t tid;
+
+    pthread_mutex_lock(&poolLock);
+    numWorkers++;
+    idleWorkers++;
+    pthread_mutex_unlock(&poolLock);
+    Pthread_create(&tid, &workerAttr, worker, NULL);
+}
+
+//pool thread: serves one client at a time, retires when idle and the pool is above its initial size
+void *worker(void *vargp) 
+{
+    while (1) {
+        int connfd = sbuf_remove_timed(&connections, WORKER_IDLE_MS);
+
+        pthread_mutex_lock(&poolLock);
+        if (connfd < 0) {
+            if (numWorkers > minWorkers) {
+                numWorkers--;
+                idleWorkers--;
+                pthread_mutex_unlock(&poolLock);
+                return NULL;
             }
+            pthread_mutex_unlock(&poolLock);
+            continue;
         }
-        
-        // if (localId == 1) {
-        //     printf("%s\n", buf); 
-        //     printf("p2.x is %d, p2.y is %d\n", player2.x, player2.y);
-        //     printf("id is %d\n", playerId); 
-        // }
+        idleWorkers--;
+        pthread_mutex_unlock(&poolLock);
+
+        serveClient(connfd);
 
-        sprintf(intToChar, "%d", score);
-        strcat(buf, intToChar);
-        strcat(buf, ",");
+        pthread_mutex_lock(&poolLock);
+        idleWorkers++;
+        pthread_mutex_unlock(&poolLock);
+    }
+}
 
-        sprintf(intToChar, "%d", numTomatoes);
-        strcat(buf, intToChar);
-        strcat(buf, ",");
 
-        sprintf(intToChar, "%d", level);
-        strcat(buf, intToChar);
-        strcat(buf, ",");
+//join or resume a player slot and play until the client disconnects
+void serveClient(int connfd) 
+{  
+    rio_t rio;
+    rio_wt wio;
+    char *hello;
+    int generation = 0;
+    unsigned ackVersion = 0;
+    struct timeval sendTimeout = {SEND_TIMEOUT_MS / 1000, (SEND_TIMEOUT_MS % 1000) * 1000};
+    struct timeval receiveTimeout = {KEEPALIVE_TIMEOUT_MS / 1000, (KEEPALIVE_TIMEOUT_MS % 1000) * 1000};
 
-        sprintf(intToChar, "%d", localId);
-        strcat(buf, intToChar);
-        strcat(buf, "\n");
+    setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+    //a client that connects and says nothing (or stops mid-line) gives the worker back
+    //after KEEPALIVE_TIMEOUT_MS instead of holding it forever
+    setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+    Rio_readinitb(&rio, connfd);
+    Rio_writeinitb(&wio, connfd);
+    if (rio_readlinev(&rio, &hello) <= 0) {
+        Close(connfd);
+        return;
+    }
 
-        pthread_mutex_unlock(&lock);
-        Rio_writen(connfd, buf, strlen(buf));
-        strcpy(buf, "");
-        //puts("beginning to read client data");
+    LOCK(SITE_JOIN);
+    expireSessions();
+    int slot = attachSession(hello, &generation, &ackVersion);
+    UNLOCK(SITE_JOIN);
+
+    if (slot < 0) {
+        rio_writeb(&wio, "f\n", 2);
+        rio_flushb(&wio);
+        Close(connfd);
+        return;
     }
 
-}
\ No newline at end of file
+    position(&rio, &wio, slot + 1, generation, ackVersion);
+
+    //keep the slot for a while unless a newer connection already resumed it
+    LOCK(SITE_LEAVE);
+    if (sessions[slot].generation == generation) {
+        sessions[slot].state = SLOT_DETACHED;
+        sessions[slot].detachedAt = time(NULL);
+    }
+    UNLOCK(SITE_LEAVE);
+
+    //sendLock waits out a push to this socket before it is closed
+    Subscriber *sub = &subscribers[slot];
+    pthread_mutex_lock(&sub->sendLock);
+    pthread_mutex_lock(&subscribersLock);
+    if (sub->generation == generation)
+        sub->active = false;
+    pthread_mutex_unlock(&subscribersLock);
+    pthread_mutex_unlock(&sub->sendLock);
+    Close(connfd);
+}
+
+//answer a ping with "q,<payload>" through the subscriber's writer, sendLock keeps the
+//tick thread's pushes to this client (and only those) off it meanwhile
+void echoPing(int slot, int generation, const char *payload)
+{
+    Subscriber *sub = &subscribers[slot];
+    char reply[40];
+    int n = snprintf(reply, sizeof(reply), "q,%.32s\n", payload);
+
+    pthread_mutex_lock(&sub->sendLock);
+    pthread_mutex_lock(&subscribersLock);
+    bool send = sub->active && sub->ready && sub->generation == generation;
+    if (send)
+        sub->lastSentMs = nowMs();
+    pthread_mutex_unlock(&subscribersLock);
+
+    if (send) {
+        rio_writeb(&sub->wio, reply, n);
+        if (rio_flushb(&sub->wio) < 0)
+            dropSubscriber(sub);
+    }
+    pthread_mutex_unlock(&sub->sendLock);
+}
+
+//send the initial state, then apply the client's moves ("m,seq,dx,dy") until it disconnects
+//or goes quiet; everything after the initial state is pushed by broadcaster()
+void position(rio_t *rio, rio_wt *wio, int localId, int generation, unsigned ackVersion) 
+{   
+    //the initial state outgrows the stack on big boards
+    size_t cap = LINE_HEADER_MAX + (ackVersion > 0 ? DELTA_LINE_MAX : STATE_LINE_MAX);
+    char *buf = Malloc(cap);
+    size_t length, idAt;
+    unsigned version, ack;
+    int slot = localId - 1;
+    ssize_t n; 
+
+    LOCK(SITE_INITIAL_ENCODE);
+    //taken over before it got going
+    if (sessions[slot].generation != generation) {
+        UNLOCK(SITE_INITIAL_ENCODE);
+        free(buf);
+        return;
+    }
+    //session token and tick length first, then the full grid or only what changed since the client's state
+    length = sprintf(buf, "t,%d,%016" PRIx64 ",%d\n", localId, sessions[slot].token, tickMs);
+    if (ackVersion > 0)
+        length += encodeDelta(buf + length, cap - length, localId, sessions[slot].lastSeq, ackVersion, &idAt);
+    else
+        length += encodeState(buf + length, cap - length, localId);
+    version = stateVersion;
+    ack = sessions[slot].lastSeq;
+    UNLOCK(SITE_INITIAL_ENCODE);
+
+    if (!subscribe(slot, generation, rio->rio_fd, version, ack)) {
+        free(buf);
+        return;
+    }
+
+    //sending the intial positions to client, pushes start once it is out
+    n = rio_writeb(wio, buf, length);
+    free(buf);
+    if (n < 0 || rio_flushb(wio) < 0)
+        return;
+    pthread_mutex_lock(&subscribersLock);
+    if (subscribers[slot].generation == generation) {
+        subscribers[slot].ready = true;
+        subscribers[slot].lastSentMs = nowMs();
+    }
+    pthread_mutex_unlock(&subscribersLock);
+
+    char *line;
+    unsigned seq;
+    int dx, dy;
+
+    //continiously read from client
+    while (1) {
+        uint64_t traceMsg = TRACE_START();
+        uint64_t traceStep;
+
+        //the client sends at least a keepalive every KEEPALIVE_MS, silence means it is gone
+        if (rio->rio_cnt <= 0) {
+            struct pollfd pfd = {rio->rio_fd, POLLIN, 0};
+            if (poll(&pfd, 1, KEEPALIVE_TIMEOUT_MS) == 0)
+                break;
+            TRACE_END("socket wait", traceMsg);
+            traceMsg = TRACE_START();
+        }
+
+        traceStep = TRACE_START();
+        n = rio_readlinev(rio, &line);
+        TRACE_END("Rio_readlinev", traceStep);
+        if (n <= 0) //line:netp:echo:eof
+            break;
+
+        if (line[0] == 'p' && line[1] == ',') {
+            echoPing(slot, generation, line + 2);
+            continue;
+        }
+
+        //"k" only keeps the connection alive, anything else unknown is ignored
+        if (sscanf(line, "m,%u,%d,%d", &seq, &dx, &dy) != 3)
+            continue;
+
+        traceStep = TRACE_START();
+        LOCK(SITE_MOVE_UPDATE);
+        TRACE_END("lock acquire", traceStep);
+        traceStep = TRACE_START();
+        //a resume took the slot over, moves from this connection no longer count
+        if (sessions[slot].generation != generation) {
+            UNLOCK(SITE_MOVE_UPDATE);
+            break;
+        }
+        expireSessions();
+        //a move resent after a resume may already have been applied; rejected moves are acked too
+        if (seq > sessions[slot].lastSeq) {
+            sessions[slot].lastSeq = seq;
+            movePlayer(slot, dx, dy);
+        }
+
+        //checking if all players has obtained a tomato
+        pickUpTomatoes();
+        UNLOCK(SITE_MOVE_UPDATE);
+        TRACE_END("state update", traceStep);
+        TRACE_END("message", traceMsg);
+    }
+}
@@ -0,0 +1,248 @@
+/*
+ * sprites.c - sprite atlas and batched sprite submission (see sprites.h)
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <SDL2/SDL_image.h>
+
+#include "sprites.h"
+
+// first bytes of a cache file, bumped whenever its layout changes
+#define SPRITE_CACHE_MAGIC "ATLAS1\n"
+
+//64-bit FNV-1a of len bytes, continuing from hash
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+//$XDG_CACHE_HOME/tomato-client/atlas-<hash of the pngs>.bin (or under ~/.cache), created
+//directories included; left empty if there is no home to put it in
+static void spriteCachePath(SpriteDecode *decode)
+{
+    const char *base = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char dir[PATH_MAX - 32]; // room for the file name
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    decode->cachePath[0] = '\0';
+    if (base != NULL && base[0] != '\0')
+        snprintf(dir, sizeof(dir), "%s/tomato-client", base);
+    else if (home != NULL && home[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+        mkdir(dir, 0755);
+        snprintf(dir, sizeof(dir), "%s/.cache/tomato-client", home);
+    }
+    else
+        return;
+    mkdir(dir, 0755);
+
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        hash = fnv1a(hash, &decode->jobs[i].size, sizeof(decode->jobs[i].size));
+        hash = fnv1a(hash, decode->jobs[i].png, decode->jobs[i].size);
+    }
+    snprintf(decode->cachePath, sizeof(decode->cachePath), "%s/atlas-%016" PRIx64 ".bin", dir, hash);
+}
+
+//the packed sheet and where each sprite is in it, NULL if there is no valid cache file
+static SDL_Surface *spriteCacheRead(const char *path, SDL_Rect rects[NUM_SPRITES])
+{
+    char magic[sizeof(SPRITE_CACHE_MAGIC)];
+    int size[2];
+    SDL_Surface *sheet = NULL;
+    FILE *f = (path[0] != '\0') ? fopen(path, "rb") : NULL;
+
+    if (f == NULL)
+        return NULL;
+    if (fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, SPRITE_CACHE_MAGIC, sizeof(magic)) == 0 &&
+        fread(size, sizeof(int), 2, f) == 2 && size[0] > 0 && size[1] > 0 && size[0] <= 16384 && size[1] <= 16384 &&
+        fread(rects, sizeof(SDL_Rect), NUM_SPRITES, f) == NUM_SPRITES)
+        sheet = SDL_CreateRGBSurfaceWithFormat(0, size[0], size[1], 32, SDL_PIXELFORMAT_RGBA32);
+
+    //rows one at a time, the surface may pad them
+    for (int y = 0; sheet != NULL && y < sheet->h; y++) {
+        if (fread((char *) sheet->pixels + y * sheet->pitch, 4, sheet->w, f) != (size_t) sheet->w) {
+            SDL_FreeSurface(sheet);
+            sheet = NULL;
+        }
+    }
+    fclose(f);
+    return sheet;
+}
+
+//save the packed sheet for next time, through a temporary file so a reader never sees half of it
+static void spriteCacheWrite(const char *path, SDL_Surface *sheet, const SDL_Rect rects[NUM_SPRITES])
+{
+    char temp[PATH_MAX + 16];
+    int size[2] = {sheet->w, sheet->h};
+    bool ok;
+
+    if (path[0] == '\0')
+        return;
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int) getpid());
+    FILE *f = fopen(temp, "wb");
+    if (f == NULL)
+        return;
+
+    ok = fwrite(SPRITE_CACHE_MAGIC, 1, sizeof(SPRITE_CACHE_MAGIC), f) == sizeof(SPRITE_CACHE_MAGIC) &&
+         fwrite(size, sizeof(int), 2, f) == 2 && fwrite(rects, sizeof(SDL_Rect), NUM_SPRITES, f) == NUM_SPRITES;
+    for (int y = 0; ok && y < sheet->h; y++)
+        ok = fwrite((char *) sheet->pixels + y * sheet->pitch, 4, sheet->w, f) == (size_t) sheet->w;
+    if (fclose(f) == 0 && ok)
+        rename(temp, path);
+    else
+        remove(temp);
+}
+
+static void *spriteDecodeThread(void *vargp)
+{
+    SpriteJob *job = vargp;
+
+    job->image = IMG_Load_RW(SDL_RWFromConstMem(job->png, job->size), 1);
+    return NULL;
+}
+
+//start decoding the png data of every sprite, each on its own thread, unless the cache
+//already holds the packed sheet; IMG_Init must have been called
+void spriteDecodeStart(SpriteDecode *decode, const void *const pngs[NUM_SPRITES], const size_t sizes[NUM_SPRITES])
+{
+    memset(decode, 0, sizeof(*decode));
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        decode->jobs[i].png = pngs[i];
+        decode->jobs[i].size = sizes[i];
+    }
+
+    spriteCachePath(decode);
+    if ((decode->sheet = spriteCacheRead(decode->cachePath, decode->rects)) != NULL)
+        return;
+
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        SpriteJob *job = &decode->jobs[i];
+        //decode right here if no thread is to be had
+        job->started = pthread_create(&job->thread, NULL, spriteDecodeThread, job) == 0;
+        if (!job->started)
+            spriteDecodeThread(job);
+    }
+}
+
+//pack the decoded images left to right into one sheet, NULL if any failed to decode
+static SDL_Surface *spritePack(SpriteDecode *decode)
+{
+    int width = 0, height = 0;
+
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        SDL_Surface *image = decode->jobs[i].image;
+        if (image == NULL)
+            return NULL;
+        decode->rects[i] = (SDL_Rect) {width, 0, image->w, image->h};
+        width += image->w;
+        if (image->h > height)
+            height = image->h;
+    }
+
+    SDL_Surface *sheet = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+    if (sheet != NULL) {
+        for (int i = 0; i < NUM_SPRITES; i++) {
+            SDL_Rect dest = decode->rects[i]; // the blit writes the clipped rect back
+            //copy alpha as is instead of blending onto the empty sheet
+            SDL_SetSurfaceBlendMode(decode->jobs[i].image, SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(decode->jobs[i].image, NULL, sheet, &dest);
+        }
+    }
+    return sheet;
+}
+
+//wait for the decoding spriteDecodeStart began and upload the packed sheet as the atlas's
+//texture, false if an image couldn't be decoded or the texture not created
+bool spriteAtlasUpload(SpriteAtlas *atlas, SDL_Renderer *renderer, SpriteDecode *decode)
+{
+    for (int i = 0; i < NUM_SPRITES; i++) {
+        if (decode->jobs[i].started)
+            pthread_join(decode->jobs[i].thread, NULL);
+    }
+
+    SDL_Surface *sheet = decode->sheet;
+    if (sheet == NULL && (sheet = spritePack(decode)) != NULL)
+        spriteCacheWrite(decode->cachePath, sheet, decode->rects);
+
+    memset(atlas, 0, sizeof(*atlas));
+    if (sheet != NULL) {
+        memcpy(atlas->rects, decode->rects, sizeof(atlas->rects));
+        atlas->width = sheet->w;
+        atlas->height = sheet->h;
+        atlas->texture = SDL_CreateTextureFromSurface(renderer, sheet);
+        SDL_FreeSurface(sheet);
+    }
+
+    for (int i = 0; i < NUM_SPRITES; i++)
+        SDL_FreeSurface(decode->jobs[i].image);
+    memset(decode, 0, sizeof(*decode));
+    return atlas->texture != NULL;
+}
+
+void spriteAtlasFree(SpriteAtlas *atlas)
+{
+    if (atlas->texture != NULL)
+        SDL_DestroyTexture(atlas->texture);
+    atlas->texture = NULL;
+}
+
+void spriteBatchBegin(SpriteBatch *batch, const SpriteAtlas *atlas)
+{
+    batch->atlas = atlas;
+    batch->count = 0;
+}
+
+//queue sprite at dst, submitting the batch first if it is full
+void spriteBatchAdd(SpriteBatch *batch, SDL_Renderer *renderer, SPRITE sprite, const SDL_Rect *dst)
+{
+    if (batch->count == SPRITE_BATCH_MAX)
+        spriteBatchFlush(batch, renderer);
+    batch->src[batch->count] = batch->atlas->rects[sprite];
+    batch->dst[batch->count] = *dst;
+    batch->count++;
+}
+
+//submit everything queued to the current render target, in the order it was added
+void spriteBatchFlush(SpriteBatch *batch, SDL_Renderer *renderer)
+{
+    if (batch->count == 0)
+        return;
+
+#ifdef SPRITES_USE_GEOMETRY
+    //two triangles per sprite, all from the atlas texture in one call
+    float width = batch->atlas->width, height = batch->atlas->height;
+    SDL_Color white = {255, 255, 255, 255};
+
+    for (int i = 0; i < batch->count; i++) {
+        const SDL_Rect *s = &batch->src[i], *d = &batch->dst[i];
+        SDL_Vertex *v = &batch->vertices[4 * i];
+        int *index = &batch->indices[6 * i];
+
+        v[0] = (SDL_Vertex) {{d->x, d->y}, white, {s->x / width, s->y / height}};
+        v[1] = (SDL_Vertex) {{d->x + d->w, d->y}, white, {(s->x + s->w) / width, s->y / height}};
+        v[2] = (SDL_Vertex) {{d->x + d->w, d->y + d->h}, white, {(s->x + s->w) / width, (s->y + s->h) / height}};
+        v[3] = (SDL_Vertex) {{d->x, d->y + d->h}, white, {s->x / width, (s->y + s->h) / height}};
+        index[0] = 4 * i;
+        index[1] = 4 * i + 1;
+        index[2] = 4 * i + 2;
+        index[3] = 4 * i;
+        index[4] = 4 * i + 2;
+        index[5] = 4 * i + 3;
+    }
+    SDL_RenderGeometry(renderer, batch->atlas->texture, batch->vertices, 4 * batch->count, batch->indices, 6 * batch->count);
+#else
+    for (int i = 0; i < batch->count; i++)
+        SDL_RenderCopy(renderer, batch->atlas->texture, &batch->src[i], &batch->dst[i]);
+#endif
+    batch->count = 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * sprites.h - one texture for every tile and player image, drawn in batches
+ *
+ * The images are packed side by side into a single atlas when they are
+ * loaded. A SpriteBatch collects the sprites of a frame and submits them
+ * together from that one texture: as a single SDL_RenderGeometry call with
+ * SDL 2.0.18 or later, otherwise as back to back SDL_RenderCopy calls that
+ * the renderer's command batching can merge (SDL_HINT_RENDER_BATCHING).
+ *
+ * Loading is split so decoding can overlap other startup work:
+ * spriteDecodeStart() decodes the PNGs on one thread each, and
+ * spriteAtlasUpload() waits for them, packs the sheet and uploads it in a
+ * single texture. The packed sheet is kept in a cache file named after a
+ * hash of the PNGs, so later starts read it back instead of decoding.
+ */
+#ifndef __SPRITES_H__
+#define __SPRITES_H__
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#define SPRITES_USE_GEOMETRY
+#endif
+
+typedef enum
+{
+    SPRITE_GRASS,
+    SPRITE_TOMATO,
+    SPRITE_PLAYER1,
+    SPRITE_PLAYER2,
+    SPRITE_PLAYER3,
+    SPRITE_PLAYER4,
+    NUM_SPRITES
+} SPRITE;
+
+// sprites a batch holds before it has to be submitted
+#define SPRITE_BATCH_MAX 512
+
+typedef struct
+{
+    SDL_Texture *texture;
+    SDL_Rect rects[NUM_SPRITES]; // where each image is in the texture
+    int width;
+    int height;
+} SpriteAtlas;
+
+// one image being decoded
+typedef struct
+{
+    const void *png;
+    size_t size;
+    SDL_Surface *image;  // NULL until decoded, or if the data isn't a valid image
+    pthread_t thread;
+    bool started;
+} SpriteJob;
+
+typedef struct
+{
+    SpriteJob jobs[NUM_SPRITES];
+    SDL_Surface *sheet;        // the packed sheet, when it came from the cache
+    SDL_Rect rects[NUM_SPRITES];
+    char cachePath[PATH_MAX];  // empty when there is nowhere to cache
+} SpriteDecode;
+
+typedef struct
+{
+    const SpriteAtlas *atlas;
+    int count;
+    SDL_Rect src[SPRITE_BATCH_MAX];
+    SDL_Rect dst[SPRITE_BATCH_MAX];
+#ifdef SPRITES_USE_GEOMETRY
+    SDL_Vertex vertices[4 * SPRITE_BATCH_MAX];
+    int indices[6 * SPRITE_BATCH_MAX];
+#endif
+} SpriteBatch;
+
+void spriteDecodeStart(SpriteDecode *decode, const void *const pngs[NUM_SPRITES], const size_t sizes[NUM_SPRITES]);
+bool spriteAtlasUpload(SpriteAtlas *atlas, SDL_Renderer *renderer, SpriteDecode *decode);
+void spriteAtlasFree(SpriteAtlas *atlas);
+void spriteBatchBegin(SpriteBatch *batch, const SpriteAtlas *atlas);
+void spriteBatchAdd(SpriteBatch *batch, SDL_Renderer *renderer, SPRITE sprite, const SDL_Rect *dst);
+void spriteBatchFlush(SpriteBatch *batch, SDL_Renderer *renderer);
+
+#endif /* __SPRITES_H__ */
@@ -0,0 +1,52 @@
+/*
+ * spsc.c - lock-free bounded FIFO for one producer and one consumer.
+ *          head and tail only ever grow; each side reads the other's
+ *          index with acquire and publishes its own with release.
+ */
+#include "csapp.h"
+#include "spsc.h"
+
+/* Create an empty queue with n slots (rounded up to a power of two) */
+void spsc_init(spsc_t *qp, unsigned n)
+{
+    unsigned size = 1;
+
+    while (size < n)
+        size <<= 1;
+    qp->buf = Calloc(size, sizeof(int));
+    qp->n = size;
+    atomic_init(&qp->head, 0);
+    atomic_init(&qp->tail, 0);
+}
+
+/* Clean up queue qp */
+void spsc_deinit(spsc_t *qp)
+{
+    Free(qp->buf);
+}
+
+/* Producer: add item at the tail, false if the queue is full */
+bool spsc_push(spsc_t *qp, int item)
+{
+    unsigned tail = atomic_load_explicit(&qp->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&qp->head, memory_order_acquire);
+
+    if (tail - head == qp->n)
+        return false;
+    qp->buf[tail & (qp->n - 1)] = item;
+    atomic_store_explicit(&qp->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/* Consumer: take the item at the head, false if the queue is empty */
+bool spsc_pop(spsc_t *qp, int *item)
+{
+    unsigned head = atomic_load_explicit(&qp->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&qp->tail, memory_order_acquire);
+
+    if (head == tail)
+        return false;
+    *item = qp->buf[head & (qp->n - 1)];
+    atomic_store_explicit(&qp->head, head + 1, memory_order_release);
+    return true;
+}
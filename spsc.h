@@ -0,0 +1,23 @@
+/*
+ * spsc.h - lock-free bounded FIFO of ints for exactly one producer thread
+ *          and one consumer thread (the sbuf_t interface without locks)
+ */
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+typedef struct {
+    int *buf;                  /* Buffer array */
+    unsigned n;                /* Number of slots, a power of two */
+    atomic_uint head;          /* Next slot to read, written by the consumer */
+    atomic_uint tail;          /* Next slot to write, written by the producer */
+} spsc_t;
+
+void spsc_init(spsc_t *qp, unsigned n);
+void spsc_deinit(spsc_t *qp);
+bool spsc_push(spsc_t *qp, int item);
+bool spsc_pop(spsc_t *qp, int *item);
+
+#endif /* __SPSC_H__ */
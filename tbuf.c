@@ -0,0 +1,44 @@
+/*
+ * tbuf.c - lock-free triple buffer. The writer and the reader each own a
+ *          slot and trade it for the middle one with a single atomic
+ *          exchange, so a snapshot is never read while it is being written.
+ */
+#include "tbuf.h"
+
+/* Create a triple buffer over three equally sized snapshots */
+void tbuf_init(tbuf_t *tp, void *a, void *b, void *c)
+{
+    tp->slot[0] = a;
+    tp->slot[1] = b;
+    tp->slot[2] = c;
+    tp->back = 0;
+    tp->front = 1;
+    atomic_init(&tp->middle, 2);
+}
+
+/* Writer: the snapshot to fill before the next tbuf_publish */
+void *tbuf_back(tbuf_t *tp)
+{
+    return tp->slot[tp->back];
+}
+
+/* Writer: make the back snapshot the newest one, take the middle one as the new back */
+void tbuf_publish(tbuf_t *tp)
+{
+    unsigned old = atomic_exchange_explicit(&tp->middle, tp->back | TBUF_FRESH, memory_order_acq_rel);
+    tp->back = old & ~TBUF_FRESH;
+}
+
+/* Reader: the newest published snapshot, *fresh says whether it changed since the last call */
+void *tbuf_front(tbuf_t *tp, bool *fresh)
+{
+    bool changed = atomic_load_explicit(&tp->middle, memory_order_relaxed) & TBUF_FRESH;
+
+    if (changed) {
+        unsigned old = atomic_exchange_explicit(&tp->middle, tp->front, memory_order_acq_rel);
+        tp->front = old & ~TBUF_FRESH;
+    }
+    if (fresh)
+        *fresh = changed;
+    return tp->slot[tp->front];
+}
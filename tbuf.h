@@ -0,0 +1,26 @@
+/*
+ * tbuf.h - lock-free triple buffer: one writer thread publishes whole
+ *          snapshots, one reader thread always gets the newest complete one
+ *          and neither ever waits for the other
+ */
+#ifndef __TBUF_H__
+#define __TBUF_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+typedef struct {
+    void *slot[3];             /* Caller-owned snapshot storage */
+    unsigned back;             /* Slot the writer fills, writer only */
+    unsigned front;            /* Slot the reader uses, reader only */
+    atomic_uint middle;        /* Slot in between, TBUF_FRESH set until read */
+} tbuf_t;
+
+#define TBUF_FRESH 4u
+
+void tbuf_init(tbuf_t *tp, void *a, void *b, void *c);
+void *tbuf_back(tbuf_t *tp);
+void tbuf_publish(tbuf_t *tp);
+void *tbuf_front(tbuf_t *tp, bool *fresh);
+
+#endif /* __TBUF_H__ */
@@ -0,0 +1,104 @@
+/*
+ * terrain.c - bitboard store for the tomato layer of the grid (see terrain.h)
+ */
+#include <string.h>
+
+#include "terrain.h"
+
+void terrainClear(Terrain *t)
+{
+    memset(t->words, 0, sizeof(t->words));
+}
+
+//tomatoes on the whole board
+int terrainCount(const Terrain *t)
+{
+    int count = 0;
+
+    for (size_t i = 0; i < TERRAIN_WORDS; i++)
+        count += __builtin_popcountll(t->words[i]);
+    return count;
+}
+
+//bits of tile (tileX, tileY) that lie inside x0 <= x < x1, y0 <= y < y1
+uint64_t terrainRectMask(int tileX, int tileY, int x0, int y0, int x1, int y1)
+{
+    int left = tileX * 8, top = tileY * 8;
+    int fromX = (x0 > left) ? x0 - left : 0, toX = (x1 < left + 8) ? x1 - left : 8;
+    int fromY = (y0 > top) ? y0 - top : 0, toY = (y1 < top + 8) ? y1 - top : 8;
+    uint64_t mask = 0;
+
+    if (fromX == 0 && toX == 8 && fromY == 0 && toY == 8)
+        return ~(uint64_t) 0;
+    for (int y = fromY; y < toY; y++) {
+        for (int x = fromX; x < toX; x++)
+            mask |= (uint64_t) 1 << terrainCell(x, y);
+    }
+    return mask;
+}
+
+//tomatoes in the cells x0 <= x < x1, y0 <= y < y1, a tile (word) at a time
+int terrainCountRect(const Terrain *t, int x0, int y0, int x1, int y1)
+{
+    int count = 0;
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > GRIDSIZE) x1 = GRIDSIZE;
+    if (y1 > GRIDSIZE) y1 = GRIDSIZE;
+    if (x0 >= x1 || y0 >= y1)
+        return 0;
+
+    for (int ty = y0 >> 3; ty <= (y1 - 1) >> 3; ty++) {
+        for (int tx = x0 >> 3; tx <= (x1 - 1) >> 3; tx++) {
+            uint64_t word = t->words[(uint64_t) ty * TERRAIN_TILES_PER_ROW + tx];
+            count += __builtin_popcountll(word & terrainRectMask(tx, ty, x0, y0, x1, y1));
+        }
+    }
+    return count;
+}
+
+//hex encode the words (least significant word first), returns the length without the NUL
+size_t terrainPack(const Terrain *t, char *out)
+{
+    static const char hex[] = "0123456789abcdef";
+    char *p = out;
+
+    for (size_t i = 0; i < TERRAIN_WORDS; i++) {
+        for (int shift = 60; shift >= 0; shift -= 4)
+            *p++ = hex[(t->words[i] >> shift) & 0xf];
+    }
+    *p = '\0';
+    return p - out;
+}
+
+//inverse of terrainPack, false (and t unchanged) if in isn't exactly a packed board
+bool terrainUnpack(Terrain *t, const char *in)
+{
+    Terrain parsed;
+
+    for (size_t i = 0; i < TERRAIN_WORDS; i++) {
+        uint64_t word = 0;
+        for (int d = 0; d < 16; d++) {
+            char c = *in++;
+            int v = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+            if (v < 0)
+                return false;
+            word = (word << 4) | v;
+        }
+        parsed.words[i] = word;
+    }
+    if (*in != '\0' && *in != ',' && *in != '\n')
+        return false;
+
+    // keep the bits past the board edge clear
+    if (GRIDSIZE % 8) {
+        int last = TERRAIN_TILES_PER_ROW - 1;
+        for (int i = 0; i < TERRAIN_TILES_PER_ROW; i++) {
+            parsed.words[(uint64_t) i * TERRAIN_TILES_PER_ROW + last] &= terrainRectMask(last, i, 0, 0, GRIDSIZE, GRIDSIZE);
+            parsed.words[(uint64_t) last * TERRAIN_TILES_PER_ROW + i] &= terrainRectMask(i, last, 0, 0, GRIDSIZE, GRIDSIZE);
+        }
+    }
+    *t = parsed;
+    return true;
+}
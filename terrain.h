@@ -0,0 +1,102 @@
+/*
+ * terrain.h - bitboard store for the tomato layer of the grid
+ *
+ * One bit per cell (1 = tomato, 0 = grass) packed into 64-bit words. Each
+ * word is an 8x8 tile of the board with its cells in Morton (Z) order, and
+ * the tiles are stored row by row. Any 8x8 neighbourhood is at most four
+ * words and a scan in either direction walks memory sequentially. A 10x10
+ * board is four words and a 1000x1000 board is about 123 KB. Tomato counts
+ * are popcounts, so there is no separate counter to drift.
+ *
+ * Always go through terrainBit()/terrainCell() (or the accessors built on
+ * them) rather than computing offsets by hand. Data kept per cell elsewhere
+ * can be indexed by terrainBit() too, so it follows the same layout.
+ */
+#ifndef __TERRAIN_H__
+#define __TERRAIN_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of cells vertically/horizontally in the grid
+#ifndef GRIDSIZE
+#define GRIDSIZE 10
+#endif
+
+#define TERRAIN_CELLS ((uint64_t) GRIDSIZE * GRIDSIZE)
+#define TERRAIN_TILES_PER_ROW ((GRIDSIZE + 7) / 8)
+#define TERRAIN_WORDS ((uint64_t) TERRAIN_TILES_PER_ROW * TERRAIN_TILES_PER_ROW)
+// size of an array indexed by terrainBit()
+#define TERRAIN_BITS (TERRAIN_WORDS * 64)
+// terrainPack output: 16 hex digits per word plus the terminating NUL
+#define TERRAIN_PACKED_SIZE (TERRAIN_WORDS * 16 + 1)
+
+typedef struct
+{
+    uint64_t words[TERRAIN_WORDS]; // bits of cells past the board edge are always 0
+} Terrain;
+
+// spreads a 3-bit coordinate to the even bits of a 6-bit Morton index
+static const uint8_t terrainSpread[8] = {0, 1, 4, 5, 16, 17, 20, 21};
+
+//Morton index of (x, y) inside its 8x8 tile
+static inline int terrainCell(int x, int y)
+{
+    return terrainSpread[x & 7] | terrainSpread[y & 7] << 1;
+}
+
+//bit index of cell (x, y): tile number * 64 + Morton index inside the tile
+static inline uint64_t terrainBit(int x, int y)
+{
+    return ((uint64_t) (y >> 3) * TERRAIN_TILES_PER_ROW + (x >> 3)) * 64 + terrainCell(x, y);
+}
+
+//the cell (x, y) of a bit index, the inverse of terrainBit()
+static inline void terrainCellOf(uint64_t bit, int *x, int *y)
+{
+    uint64_t tile = bit / 64;
+    int morton = bit % 64;
+    int evens = morton & 0x15, odds = (morton >> 1) & 0x15;
+
+    *x = (tile % TERRAIN_TILES_PER_ROW) * 8 + ((evens & 1) | ((evens >> 1) & 2) | ((evens >> 2) & 4));
+    *y = (tile / TERRAIN_TILES_PER_ROW) * 8 + ((odds & 1) | ((odds >> 1) & 2) | ((odds >> 2) & 4));
+}
+
+static inline bool terrainHasTomato(const Terrain *t, int x, int y)
+{
+    uint64_t bit = terrainBit(x, y);
+    return (t->words[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline void terrainSetTomato(Terrain *t, int x, int y)
+{
+    uint64_t bit = terrainBit(x, y);
+    t->words[bit / 64] |= (uint64_t) 1 << (bit % 64);
+}
+
+static inline void terrainPut(Terrain *t, int x, int y, bool tomato)
+{
+    uint64_t bit = terrainBit(x, y);
+    uint64_t mask = (uint64_t) 1 << (bit % 64);
+    t->words[bit / 64] = tomato ? (t->words[bit / 64] | mask) : (t->words[bit / 64] & ~mask);
+}
+
+//returns whether there was a tomato to take
+static inline bool terrainTakeTomato(Terrain *t, int x, int y)
+{
+    uint64_t bit = terrainBit(x, y);
+    uint64_t mask = (uint64_t) 1 << (bit % 64);
+    bool had = t->words[bit / 64] & mask;
+    t->words[bit / 64] &= ~mask;
+    return had;
+}
+
+void terrainClear(Terrain *t);
+uint64_t terrainRectMask(int tileX, int tileY, int x0, int y0, int x1, int y1);
+int terrainCount(const Terrain *t);
+int terrainCountRect(const Terrain *t, int x0, int y0, int x1, int y1);
+size_t terrainPack(const Terrain *t, char *out);
+bool terrainUnpack(Terrain *t, const char *in);
+
+#endif /* __TERRAIN_H__ */
@@ -0,0 +1,188 @@
+/*
+ * trace.c - optional Chrome trace-event recording (see trace.h)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+typedef struct
+{
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+} TraceEvent;
+
+typedef struct TraceRing
+{
+    struct TraceRing *next;
+    int inUse;            // owned by a live thread; a retired ring goes to the next new thread
+    pthread_mutex_t lock; // the owner holds it per event, a dump while copying the ring
+    long tid;
+    uint64_t head; // total number of events ever written
+    TraceEvent events[TRACE_RING_SIZE];
+} TraceRing;
+
+int traceEnabled = 0;
+
+static const char *traceProcess;
+static void (*traceQuit)(void);
+static char tracePath[512];
+static TraceRing *rings; // every ring ever made, guarded by ringsLock
+static pthread_mutex_t ringsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ringKey; // its destructor retires the thread's ring
+static __thread TraceRing *localRing;
+
+uint64_t traceNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//thread exit: the ring (and the events in it) stays for dumps until another thread takes it over
+static void retireRing(void *ring)
+{
+    pthread_mutex_lock(&ringsLock);
+    ((TraceRing *) ring)->inUse = 0;
+    pthread_mutex_unlock(&ringsLock);
+}
+
+//the calling thread's ring: a retired one if there is any, so threads that come and go
+//(the server's worker pool) don't each leave one behind
+static TraceRing *claimRing(void)
+{
+    TraceRing *r;
+
+    pthread_mutex_lock(&ringsLock);
+    for (r = rings; r != NULL && r->inUse; r = r->next)
+        ;
+    if (r == NULL && (r = calloc(1, sizeof(TraceRing))) != NULL) {
+        pthread_mutex_init(&r->lock, NULL);
+        r->next = rings;
+        rings = r;
+    }
+    if (r != NULL) {
+        r->inUse = 1;
+        pthread_mutex_lock(&r->lock);
+        r->tid = syscall(SYS_gettid);
+        r->head = 0;
+        pthread_mutex_unlock(&r->lock);
+    }
+    pthread_mutex_unlock(&ringsLock);
+
+    if (r != NULL)
+        pthread_setspecific(ringKey, r);
+    return r;
+}
+
+void traceSpan(const char *name, uint64_t start)
+{
+    uint64_t end = traceNow();
+
+    if (localRing == NULL && (localRing = claimRing()) == NULL)
+        return;
+
+    pthread_mutex_lock(&localRing->lock);
+    TraceEvent *e = &localRing->events[localRing->head % TRACE_RING_SIZE];
+    e->name = name;
+    e->start = start;
+    e->duration = end - start;
+    localRing->head++;
+    pthread_mutex_unlock(&localRing->lock);
+}
+
+//write every ring as complete ("X") events; each is copied out under its lock so its
+//thread only waits for the copy, not the formatting
+void traceDump(void)
+{
+    if (!traceEnabled)
+        return;
+
+    TraceRing *copy = malloc(sizeof(TraceRing));
+    pthread_mutex_lock(&ringsLock);
+    FILE *fp = copy != NULL ? fopen(tracePath, "w") : NULL;
+    if (fp == NULL) {
+        pthread_mutex_unlock(&ringsLock);
+        free(copy);
+        perror("trace dump");
+        return;
+    }
+
+    int pid = getpid();
+    fprintf(fp, "{\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+            pid, traceProcess);
+    for (TraceRing *r = rings; r != NULL; r = r->next) {
+        pthread_mutex_lock(&r->lock);
+        memcpy(copy, r, sizeof(TraceRing));
+        pthread_mutex_unlock(&r->lock);
+
+        uint64_t first = copy->head > TRACE_RING_SIZE ? copy->head - TRACE_RING_SIZE : 0;
+        for (uint64_t i = first; i < copy->head; i++) {
+            TraceEvent *e = &copy->events[i % TRACE_RING_SIZE];
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%llu,\"dur\":%llu}",
+                    e->name, pid, copy->tid, (unsigned long long) e->start,
+                    (unsigned long long) e->duration);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    pthread_mutex_unlock(&ringsLock);
+    free(copy);
+
+    fprintf(stderr, "trace written to %s\n", tracePath);
+}
+
+//dumps on SIGUSR1; on SIGINT/SIGTERM asks the program to quit, which dumps in atexit,
+//or without a quit function dumps and ends the process itself
+static void *traceSignalThread(void *vargp)
+{
+    sigset_t *set = vargp;
+    int sig;
+
+    while (sigwait(set, &sig) == 0) {
+        if (sig == SIGUSR1)
+            traceDump();
+        else if (traceQuit != NULL)
+            traceQuit();
+        else {
+            traceDump();
+            _exit(0);
+        }
+    }
+    return NULL;
+}
+
+void traceInit(const char *processName, void (*quit)(void))
+{
+    char *prefix = getenv("TRACE_FILE");
+    if (prefix == NULL || *prefix == '\0')
+        return;
+
+    traceProcess = processName;
+    traceQuit = quit;
+    pthread_key_create(&ringKey, retireRing);
+    snprintf(tracePath, sizeof(tracePath), "%s-%s-%d.json", prefix, processName, (int) getpid());
+    traceEnabled = 1;
+    atexit(traceDump);
+
+    // block the signals here so every thread created later inherits the mask
+    // and only traceSignalThread ever receives them
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, traceSignalThread, &set) == 0)
+        pthread_detach(tid);
+}
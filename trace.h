@@ -0,0 +1,35 @@
+/*
+ * trace.h - optional Chrome trace-event recording
+ *
+ * Tracing is off unless the TRACE_FILE environment variable is set. Spans are
+ * kept in per-thread ring buffers and written as Chrome trace JSON
+ * (chrome://tracing or ui.perfetto.dev) to "$TRACE_FILE-<process>-<pid>.json"
+ * on exit (including the one SIGINT/SIGTERM leads to) and whenever the
+ * process receives SIGUSR1. Each thread's ring is reused by a later thread
+ * once it exits.
+ * Timestamps come from CLOCK_MONOTONIC so client and server traces taken on
+ * the same machine line up.
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+// events kept per thread, older events are overwritten
+#define TRACE_RING_SIZE 16384
+
+extern int traceEnabled;
+
+// must be called from main() before any other thread is created; quit is called
+// (from another thread) on SIGINT/SIGTERM and should make the program leave through
+// its normal exit path, NULL writes the trace and ends the process right away
+void traceInit(const char *processName, void (*quit)(void));
+uint64_t traceNow(void);
+void traceSpan(const char *name, uint64_t start);
+void traceDump(void);
+
+// name must be a string literal (only the pointer is stored)
+#define TRACE_START() (traceEnabled ? traceNow() : 0)
+#define TRACE_END(name, start) do { if (traceEnabled) traceSpan(name, start); } while (0)
+
+#endif /* __TRACE_H__ */